@@ -0,0 +1,745 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alpha.h"
+#include "color.h"
+#include "enhance.h"
+#include "glyphs.h"
+#include "match.h"
+#include "output.h"
+#include "render.h"
+#include "stb_image.h"
+#include "stb_image_resize.h"
+
+// Images are rendered this many cells wide, at half the image aspect ratio
+// since a cell is about twice as tall as it is wide
+typedef struct BenchSize {
+    int img_w;
+    int img_h;
+    int cols;
+} BenchSize;
+
+static const BenchSize sizes[] = {
+    {320, 240, 80},
+    {1280, 720, 160},
+    {3840, 2160, 320},
+};
+
+typedef enum Pattern {
+    PATTERN_GRADIENT,
+    PATTERN_NOISE,
+    PATTERN_TEXT,
+    PATTERN_FLAT,
+    PATTERN_COUNT,
+} Pattern;
+
+static const char* pattern_names[PATTERN_COUNT] = {"gradient", "noise", "text",
+                                                   "flat"};
+
+static const ColorMode color_modes[] = {COLOR_TRUE, COLOR_256, COLOR_256_LUT};
+static const char* color_mode_names[] = {"true", "256", "256lut"};
+
+typedef enum Stage {
+    STAGE_DECODE,
+    STAGE_RESIZE,
+    STAGE_ALPHA,
+    STAGE_MATCH,
+    STAGE_QUANT,
+    STAGE_EMIT,
+    STAGE_RENDER,
+    STAGE_COUNT,
+} Stage;
+
+static const char* stage_names[STAGE_COUNT] = {
+    "decode", "resize", "alpha", "match", "quant", "emit", "render"};
+
+typedef struct Bench {
+    // Encoded source image
+    uint8_t* png;
+    size_t png_len;
+    int img_w;
+    int img_h;
+    uint32_t* img;
+
+    int enhance_level;
+    ColorMode color_mode;
+    int pixel_w;
+    int pixel_h;
+    int cols;
+    int rows;
+    int resize_w;
+    int resize_h;
+    // Resized pixels, a scratch copy and the premultiplied result
+    uint32_t* resize;
+    uint32_t* scratch;
+    uint32_t* pixels;
+
+    // Matched cells, printed in each color mode
+    CellGrid grid;
+    // Colors the emitter encodes, in cell order
+    uint32_t* quant;
+    size_t quant_count;
+
+    OutBuf out;
+    CellCache cache;
+    RenderOptions opts;
+    uint32_t sink;
+} Bench;
+
+static void* xmalloc(size_t size) {
+    void* p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "Cannot allocate memory for benchmark\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// xorshift32, so every run sees the same images
+static uint32_t nextRandom(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static uint32_t makePixel(int r, int g, int b, int a) {
+    Color c = {.r = r, .g = g, .b = b, .a = a};
+    return c.color;
+}
+
+static uint32_t* generateImage(Pattern pattern, int w, int h) {
+    uint32_t* img = xmalloc(sizeof(uint32_t) * w * h);
+    uint32_t seed = 0x9e3779b9u + pattern;
+    switch (pattern) {
+        case PATTERN_GRADIENT:
+            // Fades out to the right to exercise the alpha pass
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    img[y * w + x] =
+                        makePixel(x * 255 / w, y * 255 / h,
+                                  (x + y) * 255 / (w + h), 255 - x * 128 / w);
+                }
+            }
+            break;
+        case PATTERN_NOISE:
+            for (int i = 0; i < w * h; i++) {
+                img[i] = nextRandom(&seed) | 0xff000000u;
+            }
+            break;
+        case PATTERN_TEXT: {
+            // Random 5x7 glyphs on a 6x10 grid, dark text on a light page
+            uint32_t bg = makePixel(240, 238, 230, 255);
+            uint32_t fg = makePixel(20, 20, 30, 255);
+            for (int gy = 0; gy < h; gy += 10) {
+                for (int gx = 0; gx < w; gx += 6) {
+                    uint64_t bits = (uint64_t)nextRandom(&seed) << 32 |
+                                    nextRandom(&seed);
+                    // Leave some gaps between words
+                    if ((bits & 0x7) == 0)
+                        bits = 0;
+                    for (int y = gy; y < gy + 10 && y < h; y++) {
+                        for (int x = gx; x < gx + 6 && x < w; x++) {
+                            int i = (y - gy) * 5 + (x - gx);
+                            int on = y - gy < 7 && x - gx < 5 &&
+                                     (bits >> (i + 3)) & 1;
+                            img[y * w + x] = on ? fg : bg;
+                        }
+                    }
+                }
+            }
+            break;
+        }
+        default: {
+            // Large rectangles of a few solid colors
+            uint32_t palette[4];
+            for (int i = 0; i < 4; i++) {
+                palette[i] = nextRandom(&seed) | 0xff000000u;
+            }
+            int block = w / 8 > 1 ? w / 8 : 1;
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    img[y * w + x] = palette[(x / block + y / block * 3) % 4];
+                }
+            }
+        }
+    }
+    return img;
+}
+
+static uint32_t crc_table[256];
+
+static void initCrcTable(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t getCrc(const uint8_t* data, size_t len) {
+    uint32_t c = 0xffffffffu;
+    for (size_t i = 0; i < len; i++) {
+        c = crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffffu;
+}
+
+static uint8_t* putBE32(uint8_t* p, uint32_t v) {
+    *p++ = v >> 24;
+    *p++ = v >> 16;
+    *p++ = v >> 8;
+    *p++ = v;
+    return p;
+}
+
+// Write a chunk whose data is already at p + 8, return the end of the chunk
+static uint8_t* finishChunk(uint8_t* p, const char* type, size_t len) {
+    putBE32(p, len);
+    memcpy(p + 4, type, 4);
+    return putBE32(p + 8 + len, getCrc(p + 4, len + 4));
+}
+
+// Encode the image as an RGBA PNG with stored deflate blocks, so the decode
+// stage measures the PNG path without a zlib dependency here
+static uint8_t* encodePng(const uint32_t* img, int w, int h, size_t* len) {
+    size_t raw_len = (size_t)(w * 4 + 1) * h;
+    size_t blocks = (raw_len + 0xffff - 1) / 0xffff;
+    size_t idat_len = 2 + raw_len + blocks * 5 + 4;
+    uint8_t* png = xmalloc(8 + 25 + 12 + idat_len + 12);
+    uint8_t* p = png;
+
+    memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+    p += 8;
+
+    uint8_t* data = p + 8;
+    data = putBE32(data, w);
+    data = putBE32(data, h);
+    *data++ = 8;  // bit depth
+    *data++ = 6;  // RGBA
+    *data++ = 0;
+    *data++ = 0;
+    *data++ = 0;
+    p = finishChunk(p, "IHDR", 13);
+
+    data = p + 8;
+    *data++ = 0x78;
+    *data++ = 0x01;
+    uint32_t a = 1, b = 0;
+    size_t pos = 0;
+    for (size_t i = 0; i < blocks; i++) {
+        size_t n = raw_len - pos < 0xffff ? raw_len - pos : 0xffff;
+        *data++ = i == blocks - 1;
+        *data++ = n;
+        *data++ = n >> 8;
+        *data++ = ~n;
+        *data++ = ~n >> 8;
+        for (size_t j = 0; j < n; j++, pos++) {
+            // Each row starts with filter type 0
+            size_t x = pos % (w * 4 + 1);
+            uint8_t v = 0;
+            if (x)
+                v = ((const uint8_t*)&img[pos / (w * 4 + 1) * w])[x - 1];
+            *data++ = v;
+            a = (a + v) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    putBE32(data, b << 16 | a);
+    p = finishChunk(p, "IDAT", idat_len);
+    p = finishChunk(p, "IEND", 0);
+
+    *len = p - png;
+    return png;
+}
+
+static double getTime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double min_time = 0.02;
+
+// Seconds per run of the stage. prepare is not timed.
+static double timeStage(Bench* b, void (*prepare)(Bench*),
+                        void (*run)(Bench*)) {
+    double total = 0, start = getTime();
+    int runs = 0;
+    do {
+        if (prepare)
+            prepare(b);
+        double t = getTime();
+        run(b);
+        total += getTime() - t;
+        runs++;
+    } while (getTime() - start < min_time || runs < 2);
+    return total / runs;
+}
+
+static void runDecode(Bench* b) {
+    int w, h;
+    uint8_t* img =
+        stbi_load_from_memory(b->png, b->png_len, &w, &h, NULL, 4);
+    if (!img) {
+        fprintf(stderr, "Cannot decode benchmark image\n");
+        exit(EXIT_FAILURE);
+    }
+    b->sink += img[0];
+    stbi_image_free(img);
+}
+
+static void runResize(Bench* b) {
+    stbir_resize_uint8((uint8_t*)b->img, b->img_w, b->img_h,
+                       sizeof(uint32_t) * b->img_w, (uint8_t*)b->resize,
+                       b->resize_w, b->resize_h, sizeof(uint32_t) * b->resize_w,
+                       4);
+}
+
+static void prepareAlpha(Bench* b) {
+    memcpy(b->scratch, b->resize,
+           sizeof(uint32_t) * b->resize_w * b->resize_h);
+}
+
+static void runAlpha(Bench* b) {
+    blendAlpha(b->scratch, b->resize_w, b->resize_h, (Color){.a = 255});
+}
+
+// Match without a cell cache, so every cell is searched
+static void runMatch(Bench* b) {
+    RenderOptions opts = {.enhance_level = b->enhance_level, .jobs = 1};
+    renderGrid(&b->grid, b->pixels, b->resize_w, &opts);
+}
+
+// Collect the colors the emitter encodes, in cell order
+static void prepareQuant(Bench* b) {
+    size_t n = 0;
+    size_t cells = (size_t)b->cols * b->rows;
+    for (size_t cell = 0; cell < cells; cell++) {
+        b->quant[n++] = b->grid.bg[cell];
+        // Spaces only show the bg color
+        if (b->enhance_level != 0)
+            b->quant[n++] = b->grid.fg[cell];
+    }
+    b->quant_count = n;
+}
+
+static void runQuant(Bench* b) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < b->quant_count; i++) {
+        sum += encodeColor(b->color_mode, b->quant[i]);
+    }
+    b->sink += sum;
+}
+
+// Same output as renderImage, from the matched grid
+static void runEmit(Bench* b) {
+    OutBuf* out = &b->out;
+    out->len = 0;
+    for (int row = 0; row < b->rows; row++) {
+        printCellRow(out, &b->grid, row, b->color_mode);
+        outPutc(out, '\n');
+    }
+}
+
+// Start every render with an empty cache, like the first image of a run
+static void prepareRender(Bench* b) {
+    b->out.len = 0;
+    if (b->opts.caches) {
+        freeCellCache(&b->cache);
+        if (initCellCache(&b->cache, 4096) != 0) {
+            fprintf(stderr, "Cannot allocate memory for cell cache\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void runRender(Bench* b) {
+    renderImage(&b->out, b->pixels, b->resize_w, b->resize_h, &b->opts);
+}
+
+static void printResult(const Bench* b, Pattern pattern, const char* mode,
+                        const double times[STAGE_COUNT], size_t bytes) {
+    size_t cells = (size_t)b->cols * b->rows;
+    printf("%-8s  %4dx%-4d  %d  %-6s", pattern_names[pattern], b->img_w,
+           b->img_h, b->enhance_level, mode);
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (times[i] > 0) {
+            printf("  %8.2f", cells / times[i] / 1e6);
+        } else {
+            printf("  %8s", "-");
+        }
+    }
+    printf("  %6.2f\n", (double)bytes / cells);
+    fflush(stdout);
+}
+
+static void benchLevel(Bench* b, Pattern pattern, int enhance_level,
+                       double decode_time) {
+    b->enhance_level = enhance_level;
+    getCellSize(enhance_level, NULL, &b->pixel_w, &b->pixel_h);
+    b->resize_w = b->cols * b->pixel_w;
+    b->resize_h = b->rows * b->pixel_h;
+
+    size_t pixel_count = (size_t)b->resize_w * b->resize_h;
+    size_t cells = (size_t)b->cols * b->rows;
+    b->resize = xmalloc(sizeof(uint32_t) * pixel_count);
+    b->scratch = xmalloc(sizeof(uint32_t) * pixel_count);
+    b->pixels = xmalloc(sizeof(uint32_t) * pixel_count);
+    RenderOptions grid_opts = {.enhance_level = enhance_level};
+    if (initRenderGrid(&b->grid, b->resize_w, b->resize_h, &grid_opts) != 0) {
+        fprintf(stderr, "Cannot allocate memory for benchmark\n");
+        exit(EXIT_FAILURE);
+    }
+    b->quant = xmalloc(sizeof(uint32_t) * 2 * cells);
+
+    double times[STAGE_COUNT] = {0};
+    times[STAGE_DECODE] = decode_time;
+    times[STAGE_RESIZE] = timeStage(b, NULL, runResize);
+    times[STAGE_ALPHA] = timeStage(b, prepareAlpha, runAlpha);
+    memcpy(b->pixels, b->scratch, sizeof(uint32_t) * pixel_count);
+    // Filling the grid is only a copy below enhance level 2
+    if (enhance_level == 2) {
+        times[STAGE_MATCH] = timeStage(b, NULL, runMatch);
+    } else {
+        runMatch(b);
+    }
+
+    for (size_t m = 0; m < sizeof(color_modes) / sizeof(color_modes[0]);
+         m++) {
+        b->color_mode = color_modes[m];
+        initColorMode(b->color_mode);
+        times[STAGE_QUANT] = timeStage(b, prepareQuant, runQuant);
+        times[STAGE_EMIT] = timeStage(b, NULL, runEmit);
+        size_t bytes = b->out.len;
+
+        b->opts = (RenderOptions){.enhance_level = enhance_level,
+                                  .color_mode = b->color_mode,
+                                  .jobs = 1};
+        if (enhance_level == 2)
+            b->opts.caches = &b->cache;
+        times[STAGE_RENDER] = timeStage(b, prepareRender, runRender);
+        printResult(b, pattern, color_mode_names[m], times, bytes);
+    }
+
+    freeCellCache(&b->cache);
+    free(b->quant);
+    freeCellGrid(&b->grid);
+    free(b->pixels);
+    free(b->scratch);
+    free(b->resize);
+}
+
+// Glyph sets the vector matchers are checked with. The counts are not whole
+// batches, so the padding is checked as well.
+typedef struct VerifySet {
+    int cell_w;
+    int cell_h;
+    int count;
+} VerifySet;
+
+static const VerifySet verify_sets[] = {
+    {4, 8, 61},
+    {8, 4, 45},
+    {8, 16, 37},
+    {16, 16, 150},
+};
+
+#define VERIFY_CELLS 50000
+
+typedef struct VectorMatch {
+    const char* name;
+    MatchFunc match;
+    WideMatchFunc wide_match;
+} VectorMatch;
+
+typedef struct VectorBlend {
+    const char* name;
+    BlendFunc blend;
+} VectorBlend;
+
+// The vector code this CPU can run
+static int getVectorMatches(VectorMatch* matches) {
+    int n = 0;
+#ifdef MATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1"))
+        matches[n++] = (VectorMatch){"sse4.1", matchSSE41, matchWideSSE41};
+    if (__builtin_cpu_supports("avx2"))
+        matches[n++] = (VectorMatch){"avx2", matchAVX2, matchWideAVX2};
+#endif
+    return n;
+}
+
+static int getVectorBlends(VectorBlend* blends) {
+    int n = 0;
+#ifdef ALPHA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        blends[n++] = (VectorBlend){"sse2", blendSSE2};
+    if (__builtin_cpu_supports("avx2"))
+        blends[n++] = (VectorBlend){"avx2", blendAVX2};
+#endif
+    return n;
+}
+
+// Write random masks as a glyph set definition and load it
+static void loadRandomGlyphSet(GlyphSet* set, const VerifySet* v,
+                               uint32_t* seed) {
+    char path[] = "/tmp/imgterm-verify-XXXXXX";
+    int fd = mkstemp(path);
+    FILE* f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) {
+        fprintf(stderr, "Cannot create glyph set %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(f, "cell %dx%d\n", v->cell_w, v->cell_h);
+    int words = v->cell_w * v->cell_h / 32;
+    for (int i = 0; i < v->count; i++) {
+        // Sparse, dense and even masks
+        int density = i % 3;
+        for (int w = 0; w < words; w++) {
+            uint32_t mask = nextRandom(seed);
+            if (density == 0)
+                mask &= nextRandom(seed);
+            if (density == 1)
+                mask |= nextRandom(seed);
+            fprintf(f, "%08x", mask);
+        }
+        fprintf(f, " U+%04X\n", 0xe000 + i);
+    }
+    fclose(f);
+    int ret = loadGlyphSet(set, path);
+    unlink(path);
+    if (ret != 0)
+        exit(EXIT_FAILURE);
+}
+
+// Flat cells and cells of a few levels give many glyphs the same distance,
+// so the order ties are broken in is checked too
+static void makeCell(Color* pixels, int count, uint32_t* seed) {
+    static const uint8_t levels[] = {0, 85, 170, 255};
+    int kind = nextRandom(seed) % 4;
+    Color flat = {.color = nextRandom(seed) | 0xff000000u};
+    for (int i = 0; i < count; i++) {
+        Color c = {.color = nextRandom(seed) | 0xff000000u};
+        if (kind == 0) {
+            c = flat;
+        } else if (kind == 1) {
+            c = nextRandom(seed) & 1 ? flat : (Color){.a = 255};
+        } else if (kind == 2) {
+            c.r = levels[c.r & 3];
+            c.g = levels[c.g & 3];
+            c.b = levels[c.b & 3];
+        }
+        pixels[i] = c;
+    }
+}
+
+static int checkMatch(const char* name, const VerifySet* v, int cell,
+                      size_t want, const Color want_colors[2], size_t got,
+                      const Color got_colors[2]) {
+    if (got == want && got_colors[0].color == want_colors[0].color &&
+        got_colors[1].color == want_colors[1].color)
+        return 0;
+    fprintf(stderr,
+            "%s matcher differs at %dx%d cell %d: glyph %zu colors "
+            "%08x %08x, scalar glyph %zu colors %08x %08x\n",
+            name, v->cell_w, v->cell_h, cell, got, got_colors[0].color,
+            got_colors[1].color, want, want_colors[0].color,
+            want_colors[1].color);
+    return 1;
+}
+
+// Match random cells with the scalar and the vector code, return the number
+// of differences
+static int verifyMatchers(const VectorMatch* matches, int match_count) {
+    int failed = 0;
+    uint32_t seed = 0x2545f491u;
+    for (size_t s = 0; s < sizeof(verify_sets) / sizeof(verify_sets[0]);
+         s++) {
+        const VerifySet* v = &verify_sets[s];
+        GlyphSet set;
+        loadRandomGlyphSet(&set, v, &seed);
+        const MatchTable* table = &set.table;
+        int pixel_count = table->words * 32;
+        Color pixels[MATCH_MAX_PIXELS];
+        int set_failed = 0;
+        for (int cell = 0; cell < VERIFY_CELLS && !set_failed; cell++) {
+            makeCell(pixels, pixel_count, &seed);
+            size_t hint = nextRandom(&seed) % table->count;
+            Color want_colors[2], got_colors[2];
+            size_t want;
+            if (table->words == 1) {
+                want = matchScalar(table, (Color(*)[4])pixels, hint,
+                                   want_colors);
+            } else {
+                want = matchWideScalar(table, pixels, hint, want_colors);
+            }
+            for (int m = 0; m < match_count; m++) {
+                size_t got;
+                if (table->words == 1) {
+                    got = matches[m].match(table, (Color(*)[4])pixels, hint,
+                                           got_colors);
+                } else {
+                    got = matches[m].wide_match(table, pixels, hint,
+                                                got_colors);
+                }
+                set_failed += checkMatch(matches[m].name, v, cell, want,
+                                         want_colors, got, got_colors);
+            }
+        }
+        printf("%dx%d, %zu glyphs, %d cells: %s\n", v->cell_w, v->cell_h,
+               table->count, VERIFY_CELLS, set_failed ? "differs" : "same");
+        failed += set_failed;
+        freeGlyphSet(&set);
+    }
+    return failed;
+}
+
+// Blend every channel value at every alpha over a range of backgrounds, from
+// an unaligned start and with a tail the vector code leaves to scalar code
+static int verifyBlends(const VectorBlend* blends, int blend_count) {
+    size_t count = 256 * 256 + 7;
+    uint32_t* src = xmalloc(sizeof(uint32_t) * (count + 1));
+    uint32_t* want = xmalloc(sizeof(uint32_t) * (count + 1));
+    uint32_t* got = xmalloc(sizeof(uint32_t) * (count + 1));
+    for (size_t i = 0; i < count + 1; i++) {
+        int v = i & 255;
+        src[i] = makePixel(v, 255 - v, v * 7 & 255, i >> 8 & 255);
+    }
+    int failed = 0;
+    for (int b = 0; b < blend_count; b++) {
+        int differs = 0;
+        for (int bg = 0; bg < 256 && !differs; bg++) {
+            Color background = {
+                .r = bg, .g = 255 - bg, .b = bg * 3 & 255, .a = 255};
+            for (int offset = 0; offset <= 1; offset++) {
+                memcpy(want, src, sizeof(uint32_t) * (count + 1));
+                memcpy(got, src, sizeof(uint32_t) * (count + 1));
+                blendScalar(want + offset, count - offset, background);
+                blends[b].blend(got + offset, count - offset, background);
+                if (memcmp(want, got, sizeof(uint32_t) * (count + 1)) != 0)
+                    differs = 1;
+            }
+        }
+        printf("blend %s: %s\n", blends[b].name, differs ? "differs" : "same");
+        failed += differs;
+    }
+    free(got);
+    free(want);
+    free(src);
+    return failed;
+}
+
+// Check the vector code this CPU runs against the scalar code
+static int verifyVectorCode(void) {
+    VectorMatch matches[2];
+    VectorBlend blends[2];
+    int match_count = getVectorMatches(matches);
+    int blend_count = getVectorBlends(blends);
+    printf("Vector matchers:");
+    for (int m = 0; m < match_count; m++) {
+        printf(" %s", matches[m].name);
+    }
+    printf("\n");
+    int failed = verifyMatchers(matches, match_count);
+    failed += verifyBlends(blends, blend_count);
+    if (failed) {
+        fprintf(stderr, "Vector code differs from the scalar code\n");
+        return -1;
+    }
+    printf("Vector code matches the scalar code\n");
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "    -t ms\n");
+    fprintf(stderr,
+            "        Minimum time to run each stage for (Default=20)\n");
+    fprintf(stderr,
+            "    -v  Check the vector code against the scalar code and "
+            "exit\n");
+    fprintf(stderr, "    -?  Print this help\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* prog = argc > 0 ? argv[0] : "bench";
+
+    int verify = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:v?")) != -1) {
+        switch (opt) {
+            case 't': {
+                int ms = atoi(optarg);
+                if (ms <= 0) {
+                    fprintf(stderr, "Time should be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                min_time = ms / 1000.0;
+                break;
+            }
+            case 'v':
+                verify = 1;
+                break;
+            default:
+                if (optopt == 0) {
+                    usage(prog);
+                    exit(EXIT_SUCCESS);
+                }
+                fprintf(stderr, "More info with \"%s -?\"\n", prog);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    initEnhance();
+    if (verify)
+        exit(verifyVectorCode() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    initCrcTable();
+
+    printf("Throughput in million cells per second, output in bytes per "
+           "cell\n");
+    printf("%-8s  %-9s  %s  %-6s", "image", "size", "e", "color");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        printf("  %8s", stage_names[i]);
+    }
+    printf("  %6s\n", "B/cell");
+
+    Bench b = {0};
+    initOutBuf(&b.out, -1, 0);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (int p = 0; p < PATTERN_COUNT; p++) {
+            b.img_w = sizes[s].img_w;
+            b.img_h = sizes[s].img_h;
+            b.cols = sizes[s].cols;
+            b.rows = b.cols * b.img_h / b.img_w / 2;
+            b.img = generateImage(p, b.img_w, b.img_h);
+            b.png = encodePng(b.img, b.img_w, b.img_h, &b.png_len);
+
+            // Decoding does not depend on the level, it is scaled to the
+            // cells of each one all the same
+            double decode_time = timeStage(&b, NULL, runDecode);
+            for (int level = 0; level <= 2; level++) {
+                benchLevel(&b, p, level, decode_time);
+            }
+
+            free(b.png);
+            free(b.img);
+        }
+    }
+    freeOutBuf(&b.out);
+
+    // Keep the results of the timed loops alive
+    if (b.sink == 1)
+        fprintf(stderr, "\n");
+    exit(EXIT_SUCCESS);
+}
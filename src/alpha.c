@@ -0,0 +1,100 @@
+#include "alpha.h"
+
+#include <pthread.h>
+
+#ifdef ALPHA_X86
+#include <immintrin.h>
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static BlendFunc blend;
+static pthread_once_t blend_once = PTHREAD_ONCE_INIT;
+
+// c * a + bg * (255 - a) is at most 255 * 255, for which (v + 128) * 257 >> 16
+// is exactly v / 255 rounded to nearest. It also fits in 16-bit lanes.
+void blendScalar(uint32_t* pixels, size_t count, Color background) {
+    for (size_t i = 0; i < count; i++) {
+        Color* c = (Color*)&pixels[i];
+        uint32_t a = c->a, na = 255 - a;
+        c->r = ((c->r * a + background.r * na + 128) * 257) >> 16;
+        c->g = ((c->g * a + background.g * na + 128) * 257) >> 16;
+        c->b = ((c->b * a + background.b * na + 128) * 257) >> 16;
+    }
+}
+
+#ifdef ALPHA_X86
+// Two pixels widened to 16-bit channels
+static inline TARGET_SSE2 __m128i blendHalfSSE2(__m128i c, __m128i bg) {
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xff), 0xff);
+    __m128i na = _mm_sub_epi16(_mm_set1_epi16(255), a);
+    __m128i v = _mm_add_epi16(_mm_mullo_epi16(c, a), _mm_mullo_epi16(bg, na));
+    v = _mm_add_epi16(v, _mm_set1_epi16(128));
+    return _mm_mulhi_epu16(v, _mm_set1_epi16(257));
+}
+
+TARGET_SSE2 void blendSSE2(uint32_t* pixels, size_t count,
+                           Color background) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i bg = _mm_unpacklo_epi8(_mm_set1_epi32(background.color), zero);
+    __m128i alpha = _mm_set1_epi32(0xff000000);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)&pixels[i]);
+        __m128i lo = blendHalfSSE2(_mm_unpacklo_epi8(p, zero), bg);
+        __m128i hi = blendHalfSSE2(_mm_unpackhi_epi8(p, zero), bg);
+        __m128i out = _mm_packus_epi16(lo, hi);
+        out = _mm_or_si128(_mm_andnot_si128(alpha, out),
+                           _mm_and_si128(p, alpha));
+        _mm_storeu_si128((__m128i*)&pixels[i], out);
+    }
+    blendScalar(pixels + i, count - i, background);
+}
+
+// Unpacking and packing stay within 128-bit lanes, so the pixel order is kept
+static inline TARGET_AVX2 __m256i blendHalfAVX2(__m256i c, __m256i bg) {
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, 0xff), 0xff);
+    __m256i na = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+    __m256i v =
+        _mm256_add_epi16(_mm256_mullo_epi16(c, a), _mm256_mullo_epi16(bg, na));
+    v = _mm256_add_epi16(v, _mm256_set1_epi16(128));
+    return _mm256_mulhi_epu16(v, _mm256_set1_epi16(257));
+}
+
+TARGET_AVX2 void blendAVX2(uint32_t* pixels, size_t count,
+                           Color background) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i bg =
+        _mm256_unpacklo_epi8(_mm256_set1_epi32(background.color), zero);
+    __m256i alpha = _mm256_set1_epi32(0xff000000);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)&pixels[i]);
+        __m256i lo = blendHalfAVX2(_mm256_unpacklo_epi8(p, zero), bg);
+        __m256i hi = blendHalfAVX2(_mm256_unpackhi_epi8(p, zero), bg);
+        __m256i out = _mm256_packus_epi16(lo, hi);
+        out = _mm256_or_si256(_mm256_andnot_si256(alpha, out),
+                              _mm256_and_si256(p, alpha));
+        _mm256_storeu_si256((__m256i*)&pixels[i], out);
+    }
+    blendScalar(pixels + i, count - i, background);
+}
+#endif
+
+static void pickBlend(void) {
+    blend = blendScalar;
+#ifdef ALPHA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        blend = blendAVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        blend = blendSSE2;
+    }
+#endif
+}
+
+void blendAlpha(uint32_t* pixels, int img_w, int img_h, Color background) {
+    pthread_once(&blend_once, pickBlend);
+    blend(pixels, (size_t)img_w * img_h, background);
+}
@@ -0,0 +1,24 @@
+#ifndef ALPHA_H
+#define ALPHA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "color.h"
+
+// Blend the pixels over the background in place, rounding each channel to the
+// nearest value. The alpha channel is left as it is.
+void blendAlpha(uint32_t* pixels, int img_w, int img_h, Color background);
+
+// Implementations blendAlpha picks from, all give the same result
+typedef void (*BlendFunc)(uint32_t* pixels, size_t count, Color background);
+
+void blendScalar(uint32_t* pixels, size_t count, Color background);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ALPHA_X86
+void blendSSE2(uint32_t* pixels, size_t count, Color background);
+void blendAVX2(uint32_t* pixels, size_t count, Color background);
+#endif
+
+#endif
@@ -0,0 +1,202 @@
+#include "anim.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alpha.h"
+#include "filedata.h"
+#include "stb_image.h"
+#include "stb_image_resize.h"
+
+// Delays this short are usually meant as "as fast as possible", which
+// browsers show at 10 fps
+#define MIN_FRAME_DELAY 20
+#define DEFAULT_FRAME_DELAY 100
+
+int loadAnimation(Animation* anim, const char* file_path) {
+    FileData file;
+    if (loadFileData(&file, file_path) != 0)
+        return -1;
+    const uint8_t* data = file.data;
+    size_t len = file.len;
+    if (len > INT32_MAX) {
+        freeFileData(&file);
+        return -1;
+    }
+
+    anim->delays = NULL;
+    anim->frame_count = 1;
+    if (len >= 6 && (memcmp(data, "GIF87a", 6) == 0 ||
+                     memcmp(data, "GIF89a", 6) == 0)) {
+        anim->frames = (uint32_t*)stbi_load_gif_from_memory(
+            data, len, &anim->delays, &anim->img_w, &anim->img_h,
+            &anim->frame_count, NULL, 4);
+    } else {
+        anim->frames = (uint32_t*)stbi_load_from_memory(
+            data, len, &anim->img_w, &anim->img_h, NULL, 4);
+    }
+    freeFileData(&file);
+    return anim->frames ? 0 : -1;
+}
+
+void freeAnimation(Animation* anim) {
+    stbi_image_free(anim->frames);
+    stbi_image_free(anim->delays);
+    anim->frames = NULL;
+    anim->delays = NULL;
+}
+
+static void restoreTerminal(int sig) {
+    static const char reset[] = "\x1b[m\x1b[?25h\n";
+    if (write(STDOUT_FILENO, reset, sizeof(reset) - 1) < 0) {
+        // Nothing left to do
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void addNanos(struct timespec* t, long ns) {
+    t->tv_sec += ns / 1000000000;
+    t->tv_nsec += ns % 1000000000;
+    if (t->tv_nsec >= 1000000000) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+static int isBefore(const struct timespec* a, const struct timespec* b) {
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+void waitFrame(struct timespec* deadline, long delay_ns) {
+    // Pace from the previous deadline so the delays do not add up drift, but
+    // do not rush to catch up after falling behind
+    addNanos(deadline, delay_ns);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (isBefore(deadline, &now)) {
+        *deadline = now;
+        return;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) ==
+           EINTR) {
+    }
+}
+
+void initFramePlayer(FramePlayer* player, OutBuf* out, int img_w, int img_h,
+                     int resize_w, int resize_h, const RenderOptions* opts,
+                     Stats* stats) {
+    player->out = out;
+    player->opts = opts;
+    player->stats = stats;
+    player->img_w = img_w;
+    player->img_h = img_h;
+    player->raw_size = !resize_w || !resize_h;
+    player->resize_w = player->raw_size ? img_w : resize_w;
+    player->resize_h = player->raw_size ? img_h : resize_h;
+
+    size_t pixel_count = (size_t)player->resize_w * player->resize_h;
+    player->pixels = malloc(sizeof(uint32_t) * pixel_count);
+    if (!player->pixels ||
+        initRenderGrid(&player->grids[0], player->resize_w, player->resize_h,
+                       opts) != 0 ||
+        initRenderGrid(&player->grids[1], player->resize_w, player->resize_h,
+                       opts) != 0) {
+        fprintf(stderr, "Cannot allocate memory for frames\n");
+        exit(EXIT_FAILURE);
+    }
+    player->grid = &player->grids[0];
+    player->prev = NULL;
+
+    signal(SIGINT, restoreTerminal);
+    signal(SIGTERM, restoreTerminal);
+    outPuts(out, "\x1b[?25l");
+}
+
+void showFrame(FramePlayer* player, const uint32_t* frame) {
+    Stats* stats = player->stats;
+    int resize_w = player->resize_w, resize_h = player->resize_h;
+    StageTime start;
+
+    startStage(stats, &start);
+    if (player->raw_size) {
+        memcpy(player->pixels, frame, sizeof(uint32_t) * resize_w * resize_h);
+    } else {
+        stbir_resize_uint8((const uint8_t*)frame, player->img_w, player->img_h,
+                           sizeof(uint32_t) * player->img_w,
+                           (uint8_t*)player->pixels, resize_w, resize_h,
+                           sizeof(uint32_t) * resize_w, 4);
+    }
+    endStage(stats, STAT_RESIZE, &start);
+
+    startStage(stats, &start);
+    blendAlpha(player->pixels, resize_w, resize_h, player->opts->background);
+    endStage(stats, STAT_ALPHA, &start);
+
+    // Writes during the render are timed on their own, leave them out
+    CellGrid* grid = player->grid;
+    StageTime write_start = {0};
+    if (stats)
+        write_start = stats->stages[STAT_WRITE];
+    startStage(stats, &start);
+    if (renderGrid(grid, player->pixels, resize_w, player->opts) != 0) {
+        fprintf(stderr, "Cannot allocate memory for render\n");
+        exit(EXIT_FAILURE);
+    }
+    printCellGrid(player->out, grid, player->prev, player->opts->color_mode);
+    endStage(stats, STAT_RENDER, &start);
+    if (stats) {
+        StageTime* render = &stats->stages[STAT_RENDER];
+        render->wall -= stats->stages[STAT_WRITE].wall - write_start.wall;
+        render->cpu -= stats->stages[STAT_WRITE].cpu - write_start.cpu;
+        stats->cells += (uint64_t)grid->cols * grid->rows;
+    }
+    flushOutBuf(player->out);
+
+    player->prev = grid;
+    player->grid = grid == &player->grids[0] ? &player->grids[1]
+                                             : &player->grids[0];
+}
+
+void freeFramePlayer(FramePlayer* player) {
+    outPuts(player->out, "\x1b[?25h");
+    flushOutBuf(player->out);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    freeCellGrid(&player->grids[0]);
+    freeCellGrid(&player->grids[1]);
+    free(player->pixels);
+}
+
+void playAnimation(OutBuf* out, const Animation* anim, int resize_w,
+                   int resize_h, int loops, const RenderOptions* opts,
+                   Stats* stats) {
+    FramePlayer player;
+    initFramePlayer(&player, out, anim->img_w, anim->img_h, resize_w,
+                    resize_h, opts, stats);
+    size_t frame_size = (size_t)anim->img_w * anim->img_h;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (int loop = 0; !loops || loop < loops; loop++) {
+        for (int i = 0; i < anim->frame_count; i++) {
+            showFrame(&player, anim->frames + frame_size * i);
+            if (loops && loop == loops - 1 && i == anim->frame_count - 1)
+                break;
+
+            int delay = anim->delays ? anim->delays[i] : 0;
+            if (delay < MIN_FRAME_DELAY)
+                delay = DEFAULT_FRAME_DELAY;
+            waitFrame(&deadline, delay * 1000000L);
+        }
+    }
+
+    freeFramePlayer(&player);
+}
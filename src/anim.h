@@ -0,0 +1,61 @@
+#ifndef ANIM_H
+#define ANIM_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "output.h"
+#include "render.h"
+#include "stats.h"
+
+typedef struct Animation {
+    // Frames of img_w x img_h pixels, one after another
+    uint32_t* frames;
+    // Milliseconds to show each frame
+    int* delays;
+    int frame_count;
+    int img_w;
+    int img_h;
+} Animation;
+
+// Shows frames of one size one after another in place, reusing its buffers.
+// Each frame after the first one only prints the cells that changed.
+typedef struct FramePlayer {
+    OutBuf* out;
+    const RenderOptions* opts;
+    Stats* stats;
+    int img_w;
+    int img_h;
+    int raw_size;
+    int resize_w;
+    int resize_h;
+    uint32_t* pixels;
+    CellGrid grids[2];
+    // Grid to fill next and the one on the screen, or NULL
+    CellGrid* grid;
+    CellGrid* prev;
+} FramePlayer;
+
+// Frames of img_w x img_h pixels are resized to resize_w x resize_h, or kept
+// at their own size if either is 0. Hides the cursor until freeFramePlayer.
+void initFramePlayer(FramePlayer* player, OutBuf* out, int img_w, int img_h,
+                     int resize_w, int resize_h, const RenderOptions* opts,
+                     Stats* stats);
+void showFrame(FramePlayer* player, const uint32_t* frame);
+void freeFramePlayer(FramePlayer* player);
+
+// Sleep until delay_ns after the deadline and move the deadline there, or to
+// now if it has already passed
+void waitFrame(struct timespec* deadline, long delay_ns);
+
+// Load all frames of a GIF, or the only frame of any other image. Free with
+// freeAnimation. Return -1 if the file cannot be read or decoded.
+int loadAnimation(Animation* anim, const char* file_path);
+void freeAnimation(Animation* anim);
+
+// Play the frames with a FramePlayer, as many times as loops or forever if 0
+void playAnimation(OutBuf* out, const Animation* anim, int resize_w,
+                   int resize_h, int loops, const RenderOptions* opts,
+                   Stats* stats);
+
+#endif
@@ -0,0 +1,283 @@
+#include "batch.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alpha.h"
+#include "filedata.h"
+#include "pool.h"
+#include "stb_image.h"
+#include "stb_image_resize.h"
+
+typedef struct QueueSlot {
+    struct ImageQueue* queue;
+    LoadedImage image;
+    FileData file;
+    // Bytes counted against the budget while the slot is in flight
+    size_t bytes;
+    int opened;
+    int done;
+} QueueSlot;
+
+struct ImageQueue {
+    char** files;
+    int count;
+    QueueSlot* slots;
+    // Next slot to load and next one to return
+    int next_load;
+    int next_image;
+    // Only used by the thread taking the images
+    size_t budget;
+    size_t in_flight;
+    LoadOptions opts;
+    ThreadPool* pool;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+// Takes the file data
+static void loadImageData(LoadedImage* image, FileData* file,
+                          const LoadOptions* opts, int use_cache) {
+    Stats* stats = opts->time_stages ? &image->stats : NULL;
+    StageTime start;
+
+    if (file->len > INT32_MAX) {
+        freeFileData(file);
+        image->status = -1;
+        return;
+    }
+
+    if (opts->cache && use_cache) {
+        OutputKey output = opts->output;
+        int info_w, info_h;
+        if (stbi_info_from_memory(file->data, file->len, &info_w, &info_h,
+                                  NULL)) {
+            if (!opts->raw_size)
+                getResizeSize(opts->size, info_w, info_h, &output.resize_w,
+                              &output.resize_h);
+            image->key = getDiskCacheKey(opts->cache, file, &output);
+        }
+        if (image->key && hasCachedOutput(opts->cache, image->key)) {
+            freeFileData(file);
+            image->cached = 1;
+            return;
+        }
+    }
+
+    int img_w, img_h, comp;
+    startStage(stats, &start);
+    uint32_t* img = (uint32_t*)stbi_load_from_memory(
+        file->data, file->len, &img_w, &img_h, &comp, 4);
+    endStage(stats, STAT_DECODE, &start);
+    freeFileData(file);
+    if (!img) {
+        image->status = -1;
+        return;
+    }
+    // Only images with an alpha channel are blended, stb_image counts the
+    // transparent color of a PNG as one
+    image->alpha = comp == 2 || comp == 4;
+
+    if (opts->defer_resize && !opts->raw_size) {
+        image->pixels = img;
+        image->src_w = img_w;
+        image->src_h = img_h;
+        getResizeSize(opts->size, img_w, img_h, &image->w, &image->h);
+        image->deferred = 1;
+        return;
+    }
+
+    uint32_t* pixels = img;
+    if (!opts->raw_size) {
+        int resize_w, resize_h;
+        getResizeSize(opts->size, img_w, img_h, &resize_w, &resize_h);
+        pixels = malloc(sizeof(uint32_t) * resize_w * resize_h);
+        if (!pixels) {
+            fprintf(stderr, "Cannot allocate memory for resize image\n");
+            exit(EXIT_FAILURE);
+        }
+        startStage(stats, &start);
+        stbir_resize_uint8((uint8_t*)img, img_w, img_h,
+                           sizeof(uint32_t) * img_w, (uint8_t*)pixels,
+                           resize_w, resize_h, sizeof(uint32_t) * resize_w, 4);
+        endStage(stats, STAT_RESIZE, &start);
+        stbi_image_free(img);
+        img_w = resize_w;
+        img_h = resize_h;
+    }
+
+    if (image->alpha) {
+        Color background = {.color = opts->output.background};
+        startStage(stats, &start);
+        blendAlpha(pixels, img_w, img_h, background);
+        endStage(stats, STAT_ALPHA, &start);
+    }
+
+    image->pixels = pixels;
+    image->w = img_w;
+    image->h = img_h;
+}
+
+// Open the file, timed as part of decoding
+static int openImage(LoadedImage* image, FileData* file,
+                     const char* file_path, const LoadOptions* opts) {
+    memset(image, 0, sizeof(*image));
+    image->file_path = file_path;
+    Stats* stats = opts->time_stages ? &image->stats : NULL;
+    StageTime start;
+    startStage(stats, &start);
+    int ret = loadFileData(file, file_path);
+    endStage(stats, STAT_DECODE, &start);
+    if (ret != 0)
+        image->status = -1;
+    return ret;
+}
+
+void loadImage(LoadedImage* image, const char* file_path,
+               const LoadOptions* opts, int use_cache) {
+    FileData file;
+    if (openImage(image, &file, file_path, opts) == 0)
+        loadImageData(image, &file, opts, use_cache);
+}
+
+void freeLoadedImage(LoadedImage* image) {
+    // The pixels come from stb_image or from malloc, stb_image allocates with
+    // malloc as well
+    free(image->pixels);
+    image->pixels = NULL;
+}
+
+static void loadTask(void* arg, int worker) {
+    (void)worker;
+    QueueSlot* slot = arg;
+    ImageQueue* queue = slot->queue;
+    loadImageData(&slot->image, &slot->file, &queue->opts, 1);
+
+    pthread_mutex_lock(&queue->lock);
+    slot->done = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Bytes of the decoded and the resized pixels, both are held while resizing.
+// A deferred resize is done in bands while rendering, only the decoded pixels
+// are held.
+static size_t estimateBytes(const FileData* file, const LoadOptions* opts) {
+    int img_w, img_h;
+    if (file->len > INT32_MAX ||
+        !stbi_info_from_memory(file->data, file->len, &img_w, &img_h, NULL))
+        return 0;
+    size_t bytes = sizeof(uint32_t) * (size_t)img_w * img_h;
+    if (!opts->raw_size && !opts->defer_resize) {
+        int resize_w, resize_h;
+        getResizeSize(opts->size, img_w, img_h, &resize_w, &resize_h);
+        bytes += sizeof(uint32_t) * (size_t)resize_w * resize_h;
+    }
+    return bytes;
+}
+
+// Start loading the files that fit in the budget, and at least the next one
+// to return
+static void startLoads(ImageQueue* queue) {
+    while (queue->next_load < queue->count) {
+        QueueSlot* slot = &queue->slots[queue->next_load];
+        const char* file_path = queue->files[queue->next_load];
+        // Kept open while waiting for room, stdin cannot be read again
+        if (!slot->opened) {
+            slot->opened = 1;
+            if (openImage(&slot->image, &slot->file, file_path,
+                          &queue->opts) != 0) {
+                slot->done = 1;
+                queue->next_load++;
+                continue;
+            }
+            slot->bytes = estimateBytes(&slot->file, &queue->opts);
+        }
+        if (queue->next_load != queue->next_image &&
+            queue->in_flight + slot->bytes > queue->budget)
+            break;
+        queue->in_flight += slot->bytes;
+        queue->next_load++;
+        if (submitTask(queue->pool, loadTask, slot) != 0) {
+            fprintf(stderr, "Cannot allocate memory for task\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+ImageQueue* createImageQueue(char* files[], int count, int threads,
+                             size_t budget, const LoadOptions* opts) {
+    ImageQueue* queue = calloc(1, sizeof(ImageQueue));
+    if (!queue)
+        return NULL;
+    queue->slots = calloc(count ? count : 1, sizeof(QueueSlot));
+    if (!queue->slots) {
+        free(queue);
+        return NULL;
+    }
+    queue->files = files;
+    queue->count = count;
+    queue->budget = budget;
+    queue->opts = *opts;
+    for (int i = 0; i < count; i++) {
+        queue->slots[i].queue = queue;
+    }
+    // Nothing to load ahead of a single file
+    if (threads > 0 && count > 1) {
+        queue->pool = createThreadPool(threads);
+        if (!queue->pool) {
+            free(queue->slots);
+            free(queue);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    return queue;
+}
+
+LoadedImage* nextImage(ImageQueue* queue) {
+    if (queue->next_image > 0) {
+        QueueSlot* prev = &queue->slots[queue->next_image - 1];
+        freeLoadedImage(&prev->image);
+        queue->in_flight -= prev->bytes;
+    }
+    if (queue->next_image == queue->count)
+        return NULL;
+
+    QueueSlot* slot = &queue->slots[queue->next_image];
+    if (!queue->pool) {
+        loadImage(&slot->image, queue->files[queue->next_image], &queue->opts,
+                  1);
+        queue->next_image++;
+        return &slot->image;
+    }
+
+    startLoads(queue);
+    pthread_mutex_lock(&queue->lock);
+    while (!slot->done) {
+        pthread_cond_wait(&queue->cond, &queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    queue->next_image++;
+    return &slot->image;
+}
+
+void destroyImageQueue(ImageQueue* queue) {
+    // Let the loads in flight finish before freeing their slots
+    if (queue->pool)
+        destroyThreadPool(queue->pool);
+    for (int i = 0; i < queue->count; i++) {
+        QueueSlot* slot = &queue->slots[i];
+        freeLoadedImage(&slot->image);
+        // Opened but never started
+        if (slot->opened && i >= queue->next_load && slot->image.status == 0)
+            freeFileData(&slot->file);
+    }
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->slots);
+    free(queue);
+}
@@ -0,0 +1,68 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "diskcache.h"
+#include "render.h"
+#include "stats.h"
+
+typedef struct LoadOptions {
+    const SizeOptions* size;
+    int raw_size;
+    // Look up outputs here if set, with the enhance level and color mode of
+    // output. Its background is blended into the pixels either way.
+    const DiskCache* cache;
+    OutputKey output;
+    // Time the stages into the stats of each image
+    int time_stages;
+    // Keep the decoded image to resize while rendering with
+    // renderScaledImage, instead of resizing it while loading
+    int defer_resize;
+} LoadOptions;
+
+// A file ready to render
+typedef struct LoadedImage {
+    const char* file_path;
+    // 0, or -1 if the file cannot be opened or decoded
+    int status;
+    // Blended over the background, at the size to render, NULL if cached is
+    // set. If deferred is set, the decoded image of src_w x src_h to resize
+    // to w x h and then blend.
+    uint32_t* pixels;
+    int w;
+    int h;
+    int src_w;
+    int src_h;
+    int deferred;
+    // The file has an alpha channel
+    int alpha;
+    // Disk cache key, 0 if not cached
+    uint64_t key;
+    // The output is in the disk cache, the pixels were not decoded
+    int cached;
+    // Decode, resize and alpha times
+    Stats stats;
+} LoadedImage;
+
+// Decode, resize and blend the file. Skip decoding if its output is in
+// the disk cache and use_cache is set.
+void loadImage(LoadedImage* image, const char* file_path,
+               const LoadOptions* opts, int use_cache);
+void freeLoadedImage(LoadedImage* image);
+
+// Loads the files ahead on their own threads, while the one before them is
+// rendered. Files are started in order as long as their decoded and resized
+// pixels fit in the memory budget, sized from their headers.
+typedef struct ImageQueue ImageQueue;
+
+// Load on the calling thread in nextImage if threads is 0
+ImageQueue* createImageQueue(char* files[], int count, int threads,
+                             size_t budget, const LoadOptions* opts);
+// Free the image returned before and wait for the next file in order,
+// NULL after the last one
+LoadedImage* nextImage(ImageQueue* queue);
+void destroyImageQueue(ImageQueue* queue);
+
+#endif
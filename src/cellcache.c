@@ -0,0 +1,68 @@
+#include "cellcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int initCellCache(CellCache* cache, size_t entries) {
+    size_t sets = 1;
+    while (sets * 2 < entries) {
+        sets *= 2;
+    }
+    cache->entries = calloc(sets * 2, sizeof(CellCacheEntry));
+    cache->mru = calloc(sets, 1);
+    if (!cache->entries || !cache->mru) {
+        freeCellCache(cache);
+        return -1;
+    }
+    cache->set_mask = sets - 1;
+    cache->hits = 0;
+    cache->misses = 0;
+    return 0;
+}
+
+void freeCellCache(CellCache* cache) {
+    free(cache->entries);
+    free(cache->mru);
+    cache->entries = NULL;
+    cache->mru = NULL;
+}
+
+static uint64_t hashCell(const uint32_t pixels[32]) {
+    uint64_t h = 0;
+    for (int i = 0; i < 32; i += 2) {
+        uint64_t v = pixels[i] | (uint64_t)pixels[i + 1] << 32;
+        h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+CellCacheEntry* lookupCellCache(CellCache* cache, Color pixels[8][4],
+                                int* hit) {
+    uint32_t key[32];
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 4; y++) {
+            key[x * 4 + y] = pixels[x][y].color & 0xffffff;
+        }
+    }
+
+    size_t set = hashCell(key) & cache->set_mask;
+    CellCacheEntry* ways = &cache->entries[set * 2];
+    for (int i = 0; i < 2; i++) {
+        if (ways[i].valid && memcmp(ways[i].pixels, key, sizeof(key)) == 0) {
+            cache->mru[set] = i;
+            cache->hits++;
+            *hit = 1;
+            return &ways[i];
+        }
+    }
+
+    // Replace the least recently used way
+    int way = !cache->mru[set];
+    cache->mru[set] = way;
+    cache->misses++;
+    memcpy(ways[way].pixels, key, sizeof(key));
+    ways[way].valid = 1;
+    *hit = 0;
+    return &ways[way];
+}
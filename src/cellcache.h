@@ -0,0 +1,37 @@
+#ifndef CELLCACHE_H
+#define CELLCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "color.h"
+
+typedef struct CellCacheEntry {
+    // Cell pixels without alpha
+    uint32_t pixels[32];
+    Color colors[2];
+    uint32_t glyph;
+    uint32_t valid;
+} CellCacheEntry;
+
+// Two-way set associative cache of matched cells, the least recently used
+// way of a set is evicted. Not thread-safe, use one per thread.
+typedef struct CellCache {
+    CellCacheEntry* entries;
+    // Most recently used way of each set
+    uint8_t* mru;
+    size_t set_mask;
+    uint64_t hits;
+    uint64_t misses;
+} CellCache;
+
+// Round entries up to a power of two, at least 2
+int initCellCache(CellCache* cache, size_t entries);
+void freeCellCache(CellCache* cache);
+
+// Look up the cell, return the entry on a hit. On a miss, return the entry to
+// fill in, with the key already stored and valid set.
+CellCacheEntry* lookupCellCache(CellCache* cache, Color pixels[8][4],
+                                int* hit);
+
+#endif
@@ -1,7 +1,7 @@
 #include "color.h"
 
-#include <math.h>
-#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
 
 uint32_t getColorSqrDist(Color a, Color b) {
     int dr = a.r - b.r;
@@ -10,92 +10,158 @@ uint32_t getColorSqrDist(Color a, Color b) {
     return dr * dr + dg * dg + db * db;
 }
 
-void setTrueColor(uint32_t color, int is_bg) {
-    Color c = {.color = color};
-    printf("\x1b[%d;2;%d;%d;%dm", is_bg ? 48 : 38, c.r, c.g, c.b);
+// Nearest level of the 6 x 6 x 6 cube (0, 95, 135, 175, 215, 255) on one
+// axis, ties go to the lower level (the lower palette index)
+static inline int getCubeLevel(int v) {
+    if (v < 48)
+        return 0;
+    if (v <= 115)
+        return 1;
+    return (v - 116) / 40 + 2;
 }
 
-static uint8_t rgb256[256][3] = {
-    {0, 0, 0},       {128, 0, 0},     {0, 128, 0},     {128, 128, 0},
-    {0, 0, 128},     {128, 0, 128},   {0, 128, 128},   {192, 192, 192},
-    {128, 128, 128}, {255, 0, 0},     {0, 255, 0},     {255, 255, 0},
-    {0, 0, 255},     {255, 0, 255},   {0, 255, 255},   {255, 255, 255},
-    {0, 0, 0},       {0, 0, 95},      {0, 0, 135},     {0, 0, 175},
-    {0, 0, 215},     {0, 0, 255},     {0, 95, 0},      {0, 95, 95},
-    {0, 95, 135},    {0, 95, 175},    {0, 95, 215},    {0, 95, 255},
-    {0, 135, 0},     {0, 135, 95},    {0, 135, 135},   {0, 135, 175},
-    {0, 135, 215},   {0, 135, 255},   {0, 175, 0},     {0, 175, 95},
-    {0, 175, 135},   {0, 175, 175},   {0, 175, 215},   {0, 175, 255},
-    {0, 215, 0},     {0, 215, 95},    {0, 215, 135},   {0, 215, 175},
-    {0, 215, 215},   {0, 215, 255},   {0, 255, 0},     {0, 255, 95},
-    {0, 255, 135},   {0, 255, 175},   {0, 255, 215},   {0, 255, 255},
-    {95, 0, 0},      {95, 0, 95},     {95, 0, 135},    {95, 0, 175},
-    {95, 0, 215},    {95, 0, 255},    {95, 95, 0},     {95, 95, 95},
-    {95, 95, 135},   {95, 95, 175},   {95, 95, 215},   {95, 95, 255},
-    {95, 135, 0},    {95, 135, 95},   {95, 135, 135},  {95, 135, 175},
-    {95, 135, 215},  {95, 135, 255},  {95, 175, 0},    {95, 175, 95},
-    {95, 175, 135},  {95, 175, 175},  {95, 175, 215},  {95, 175, 255},
-    {95, 215, 0},    {95, 215, 95},   {95, 215, 135},  {95, 215, 175},
-    {95, 215, 215},  {95, 215, 255},  {95, 255, 0},    {95, 255, 95},
-    {95, 255, 135},  {95, 255, 175},  {95, 255, 215},  {95, 255, 255},
-    {135, 0, 0},     {135, 0, 95},    {135, 0, 135},   {135, 0, 175},
-    {135, 0, 215},   {135, 0, 255},   {135, 95, 0},    {135, 95, 95},
-    {135, 95, 135},  {135, 95, 175},  {135, 95, 215},  {135, 95, 255},
-    {135, 135, 0},   {135, 135, 95},  {135, 135, 135}, {135, 135, 175},
-    {135, 135, 215}, {135, 135, 255}, {135, 175, 0},   {135, 175, 95},
-    {135, 175, 135}, {135, 175, 175}, {135, 175, 215}, {135, 175, 255},
-    {135, 215, 0},   {135, 215, 95},  {135, 215, 135}, {135, 215, 175},
-    {135, 215, 215}, {135, 215, 255}, {135, 255, 0},   {135, 255, 95},
-    {135, 255, 135}, {135, 255, 175}, {135, 255, 215}, {135, 255, 255},
-    {175, 0, 0},     {175, 0, 95},    {175, 0, 135},   {175, 0, 175},
-    {175, 0, 215},   {175, 0, 255},   {175, 95, 0},    {175, 95, 95},
-    {175, 95, 135},  {175, 95, 175},  {175, 95, 215},  {175, 95, 255},
-    {175, 135, 0},   {175, 135, 95},  {175, 135, 135}, {175, 135, 175},
-    {175, 135, 215}, {175, 135, 255}, {175, 175, 0},   {175, 175, 95},
-    {175, 175, 135}, {175, 175, 175}, {175, 175, 215}, {175, 175, 255},
-    {175, 215, 0},   {175, 215, 95},  {175, 215, 135}, {175, 215, 175},
-    {175, 215, 215}, {175, 215, 255}, {175, 255, 0},   {175, 255, 95},
-    {175, 255, 135}, {175, 255, 175}, {175, 255, 215}, {175, 255, 255},
-    {215, 0, 0},     {215, 0, 95},    {215, 0, 135},   {215, 0, 175},
-    {215, 0, 215},   {215, 0, 255},   {215, 95, 0},    {215, 95, 95},
-    {215, 95, 135},  {215, 95, 175},  {215, 95, 215},  {215, 95, 255},
-    {215, 135, 0},   {215, 135, 95},  {215, 135, 135}, {215, 135, 175},
-    {215, 135, 215}, {215, 135, 255}, {215, 175, 0},   {215, 175, 95},
-    {215, 175, 135}, {215, 175, 175}, {215, 175, 215}, {215, 175, 255},
-    {215, 215, 0},   {215, 215, 95},  {215, 215, 135}, {215, 215, 175},
-    {215, 215, 215}, {215, 215, 255}, {215, 255, 0},   {215, 255, 95},
-    {215, 255, 135}, {215, 255, 175}, {215, 255, 215}, {215, 255, 255},
-    {255, 0, 0},     {255, 0, 95},    {255, 0, 135},   {255, 0, 175},
-    {255, 0, 215},   {255, 0, 255},   {255, 95, 0},    {255, 95, 95},
-    {255, 95, 135},  {255, 95, 175},  {255, 95, 215},  {255, 95, 255},
-    {255, 135, 0},   {255, 135, 95},  {255, 135, 135}, {255, 135, 175},
-    {255, 135, 215}, {255, 135, 255}, {255, 175, 0},   {255, 175, 95},
-    {255, 175, 135}, {255, 175, 175}, {255, 175, 215}, {255, 175, 255},
-    {255, 215, 0},   {255, 215, 95},  {255, 215, 135}, {255, 215, 175},
-    {255, 215, 215}, {255, 215, 255}, {255, 255, 0},   {255, 255, 95},
-    {255, 255, 135}, {255, 255, 175}, {255, 255, 215}, {255, 255, 255},
-    {8, 8, 8},       {18, 18, 18},    {28, 28, 28},    {38, 38, 38},
-    {48, 48, 48},    {58, 58, 58},    {68, 68, 68},    {78, 78, 78},
-    {88, 88, 88},    {98, 98, 98},    {108, 108, 108}, {118, 118, 118},
-    {128, 128, 128}, {138, 138, 138}, {148, 148, 148}, {158, 158, 158},
-    {168, 168, 168}, {178, 178, 178}, {188, 188, 188}, {198, 198, 198},
-    {208, 208, 208}, {218, 218, 218}, {228, 228, 228}, {238, 238, 238},
-};
-
-void set256Color(uint32_t color, int is_bg) {
+static const uint8_t cube_levels[6] = {0, 95, 135, 175, 215, 255};
+
+static uint32_t get256ColorIndex(uint32_t color) {
     // Standard colors and high-intensity colors may change
-    // Use 6 x 6 x 6 cube (216 colors) only
-    int index = 16;
-    uint32_t min_dist = UINT32_MAX;
-    for (int i = 16; i < 256; i++) {
-        Color pixel = {.color = color};
-        Color color256 = {
-            .r = rgb256[i][0], .g = rgb256[i][1], .b = rgb256[i][2]};
-        uint32_t dist = getColorSqrDist(pixel, color256);
+    // Use 6 x 6 x 6 cube (216 colors) and the grayscale ramp only.
+    // The cube is separable, so its nearest entry is the nearest level on
+    // each axis. The ramp is 8 + 10 * k, nearest to the mean of the channels.
+    Color pixel = {.color = color};
+    int r = getCubeLevel(pixel.r);
+    int g = getCubeLevel(pixel.g);
+    int b = getCubeLevel(pixel.b);
+    Color cube = {
+        .r = cube_levels[r], .g = cube_levels[g], .b = cube_levels[b]};
+    int index = 16 + r * 36 + g * 6 + b;
+    uint32_t min_dist = getColorSqrDist(pixel, cube);
+
+    int sum = pixel.r + pixel.g + pixel.b;
+    int k = (sum - 24 + 15) / 30;
+    for (int i = k - 1; i <= k + 1; i++) {
+        if (i < 0 || i > 23)
+            continue;
+        uint8_t v = 8 + i * 10;
+        Color gray = {.r = v, .g = v, .b = v};
+        uint32_t dist = getColorSqrDist(pixel, gray);
         if (dist < min_dist) {
             min_dist = dist;
-            index = i;
+            index = 232 + i;
+        }
+    }
+    return index;
+}
+
+// Palette indices of colors with 5 bits per channel, built on first use
+static uint8_t lut256[1 << 15];
+static pthread_once_t lut256_once = PTHREAD_ONCE_INIT;
+
+static void build256Lut(void) {
+    for (int i = 0; i < (1 << 15); i++) {
+        // Use the center of the range each entry covers
+        Color c = {.r = (i >> 10) << 3 | 4,
+                   .g = ((i >> 5) & 0x1f) << 3 | 4,
+                   .b = (i & 0x1f) << 3 | 4};
+        lut256[i] = get256ColorIndex(c.color);
+    }
+}
+
+uint32_t encodeColor(ColorMode mode, uint32_t color) {
+    switch (mode) {
+        case COLOR_256:
+            return get256ColorIndex(color);
+        case COLOR_256_LUT: {
+            Color c = {.color = color};
+            return lut256[(c.r >> 3) << 10 | (c.g >> 3) << 5 | c.b >> 3];
         }
+        default:
+            return color & 0xffffff;
+    }
+}
+
+// Format the parameters of an encoded color, like "48;2;255;255;255"
+static char* formatColor(char* p, ColorMode mode, uint32_t code, int is_bg) {
+    *p++ = is_bg ? '4' : '3';
+    *p++ = '8';
+    *p++ = ';';
+    if (mode != COLOR_TRUE) {
+        *p++ = '5';
+        *p++ = ';';
+        return formatUint8(p, code);
     }
-    printf("\x1b[%d;5;%dm", is_bg ? 48 : 38, index);
+    Color c = {.color = code};
+    *p++ = '2';
+    *p++ = ';';
+    p = formatUint8(p, c.r);
+    *p++ = ';';
+    p = formatUint8(p, c.g);
+    *p++ = ';';
+    return formatUint8(p, c.b);
+}
+
+void initColorMode(ColorMode mode) {
+    if (mode == COLOR_256_LUT)
+        pthread_once(&lut256_once, build256Lut);
+}
+
+void initColorState(ColorState* state, ColorMode mode) {
+    initColorMode(mode);
+    state->mode = mode;
+    resetColorState(state);
+}
+
+void resetColorState(ColorState* state) {
+    state->fg = COLOR_UNSET;
+    state->bg = COLOR_UNSET;
+}
+
+void setColors(OutBuf* out, ColorState* state, uint32_t bg, uint32_t fg) {
+    setColorCodes(out, state, encodeColor(state->mode, bg),
+                  encodeColor(state->mode, fg));
+}
+
+void setColorCodes(OutBuf* out, ColorState* state, uint32_t bg_code,
+                   uint32_t fg_code) {
+    int set_bg = bg_code != state->bg;
+    int set_fg = fg_code != state->fg;
+    if (!set_bg && !set_fg)
+        return;
+
+    // Longest is "\x1b[48;2;255;255;255;38;2;255;255;255m"
+    char* p = reserveOutBuf(out, 38);
+    if (!p)
+        return;
+    *p++ = '\x1b';
+    *p++ = '[';
+    if (set_bg) {
+        p = formatColor(p, state->mode, bg_code, 1);
+        state->bg = bg_code;
+    }
+    if (set_fg) {
+        if (set_bg)
+            *p++ = ';';
+        p = formatColor(p, state->mode, fg_code, 0);
+        state->fg = fg_code;
+    }
+    *p++ = 'm';
+    out->len = p - out->data;
+}
+
+void setBgColor(OutBuf* out, ColorState* state, uint32_t bg) {
+    setBgCode(out, state, encodeColor(state->mode, bg));
+}
+
+void setBgCode(OutBuf* out, ColorState* state, uint32_t bg_code) {
+    if (bg_code == state->bg)
+        return;
+
+    char* p = reserveOutBuf(out, 20);
+    if (!p)
+        return;
+    *p++ = '\x1b';
+    *p++ = '[';
+    p = formatColor(p, state->mode, bg_code, 1);
+    *p++ = 'm';
+    out->len = p - out->data;
+    state->bg = bg_code;
 }
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "output.h"
+
 typedef union Color {
     uint32_t color;
     struct {
@@ -13,11 +15,43 @@ typedef union Color {
     };
 } Color;
 
-typedef void (*SetColorFunc)(uint32_t color, int is_bg);
+typedef enum ColorMode {
+    COLOR_TRUE,
+    COLOR_256,
+    // 256 colors from a 15-bit lookup table, may differ from the exact
+    // nearest color by one step
+    COLOR_256_LUT,
+    // No colors, only the glyphs
+    COLOR_NONE,
+} ColorMode;
+
+// Colors last sent to the terminal, so unchanged ones are not sent again
+typedef struct ColorState {
+    ColorMode mode;
+    // Encoded colors, COLOR_UNSET after a reset
+    uint32_t fg;
+    uint32_t bg;
+} ColorState;
+
+#define COLOR_UNSET UINT32_MAX
 
 uint32_t getColorSqrDist(Color a, Color b);
 
-void setTrueColor(uint32_t color, int is_bg);
-void set256Color(uint32_t color, int is_bg);
+// Build the tables of the mode, before calling encodeColor
+void initColorMode(ColorMode mode);
+// Palette index in 256-color modes, 24-bit RGB otherwise
+uint32_t encodeColor(ColorMode mode, uint32_t color);
+
+void initColorState(ColorState* state, ColorMode mode);
+// Forget the colors after "\x1b[m"
+void resetColorState(ColorState* state);
+
+// Send the colors that differ from the state in a single escape sequence
+void setColors(OutBuf* out, ColorState* state, uint32_t bg, uint32_t fg);
+void setBgColor(OutBuf* out, ColorState* state, uint32_t bg);
+// Same with colors already encoded in the mode of the state
+void setColorCodes(OutBuf* out, ColorState* state, uint32_t bg_code,
+                   uint32_t fg_code);
+void setBgCode(OutBuf* out, ColorState* state, uint32_t bg_code);
 
 #endif
@@ -0,0 +1,774 @@
+// For struct ucred
+#define _GNU_SOURCE
+
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "alpha.h"
+#include "filedata.h"
+#include "output.h"
+#include "stb_image.h"
+#include "stb_image_resize.h"
+
+// Give up on a client that stops reading for this long
+#define CLIENT_TIMEOUT_SEC 5
+#define MAX_PATH_LEN 4096
+// Largest target and screen size of a request in cells, larger ones are
+// clamped
+#define MAX_REQUEST_CELLS 4096
+// Largest image a request may be resized to
+#define MAX_RESIZE_PIXELS (1 << 26)
+
+// A file is the same while all of these are
+typedef struct FileKey {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+} FileKey;
+
+typedef enum ImageKind {
+    IMAGE_DECODED,
+    // Blended over the background, resized or at the raw size
+    IMAGE_RESIZED,
+    IMAGE_RAW,
+} ImageKind;
+
+typedef struct CachedImage {
+    FileKey file;
+    ImageKind kind;
+    int w;
+    int h;
+    // Size of the decoded image
+    int img_w;
+    int img_h;
+    // The decoded image has an alpha channel
+    int alpha;
+    // Background blended in, if not decoded
+    uint32_t background;
+    uint32_t* pixels;
+    size_t bytes;
+    struct CachedImage* prev;
+    struct CachedImage* next;
+} CachedImage;
+
+// Least recently used images are evicted first
+typedef struct ImageCache {
+    CachedImage* head;
+    CachedImage* tail;
+    size_t bytes;
+    size_t limit;
+} ImageCache;
+
+static const char* socket_to_unlink;
+
+static void stopDaemon(int sig) {
+    if (socket_to_unlink)
+        unlink(socket_to_unlink);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void getDaemonSocketPath(char* path, size_t size) {
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir) {
+        snprintf(path, size, "%s/imgterm.sock", dir);
+    } else {
+        snprintf(path, size, "/tmp/imgterm-%u.sock", (unsigned)getuid());
+    }
+}
+
+// Without $XDG_RUNTIME_DIR another user may have taken the socket path first,
+// so both ends only talk to processes of the same user
+static int isSameUser(int sock) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+           cred.uid == getuid();
+}
+
+static void unlinkImage(ImageCache* cache, CachedImage* image) {
+    if (image->prev) {
+        image->prev->next = image->next;
+    } else {
+        cache->head = image->next;
+    }
+    if (image->next) {
+        image->next->prev = image->prev;
+    } else {
+        cache->tail = image->prev;
+    }
+}
+
+static void pushImage(ImageCache* cache, CachedImage* image) {
+    image->prev = NULL;
+    image->next = cache->head;
+    if (cache->head) {
+        cache->head->prev = image;
+    } else {
+        cache->tail = image;
+    }
+    cache->head = image;
+}
+
+static int isSameFile(const FileKey* a, const FileKey* b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->mtime_ns == b->mtime_ns;
+}
+
+// Find the image and move it to the front, the size and background are
+// ignored for the decoded image
+static CachedImage* findImage(ImageCache* cache, const FileKey* file,
+                              ImageKind kind, int w, int h,
+                              uint32_t background) {
+    for (CachedImage* image = cache->head; image; image = image->next) {
+        if (isSameFile(&image->file, file) && image->kind == kind &&
+            (kind == IMAGE_DECODED ||
+             (image->w == w && image->h == h &&
+              image->background == background))) {
+            unlinkImage(cache, image);
+            pushImage(cache, image);
+            return image;
+        }
+    }
+    return NULL;
+}
+
+// Any image of the file, to know its size
+static CachedImage* findFile(ImageCache* cache, const FileKey* file) {
+    for (CachedImage* image = cache->head; image; image = image->next) {
+        if (isSameFile(&image->file, file))
+            return image;
+    }
+    return NULL;
+}
+
+static void freeImage(CachedImage* image) {
+    // stb_image allocates with malloc as well
+    free(image->pixels);
+    free(image);
+}
+
+// Take the image and evict others to fit. Return -1 if it does not fit at
+// all, then it stays with the caller.
+static int addImage(ImageCache* cache, CachedImage* image) {
+    if (image->bytes > cache->limit)
+        return -1;
+    while (cache->tail && cache->bytes + image->bytes > cache->limit) {
+        CachedImage* old = cache->tail;
+        unlinkImage(cache, old);
+        cache->bytes -= old->bytes;
+        freeImage(old);
+    }
+    pushImage(cache, image);
+    cache->bytes += image->bytes;
+    return 0;
+}
+
+static CachedImage* newImage(const FileKey* file, ImageKind kind, int w,
+                             int h, uint32_t* pixels) {
+    CachedImage* image = calloc(1, sizeof(CachedImage));
+    if (!image)
+        return NULL;
+    image->file = *file;
+    image->kind = kind;
+    image->w = w;
+    image->h = h;
+    image->pixels = pixels;
+    image->bytes = sizeof(uint32_t) * w * h + sizeof(CachedImage);
+    return image;
+}
+
+static ssize_t sendAll(int fd, const void* data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(fd, (const char*)data + sent, len - sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+static ssize_t recvAll(int fd, void* data, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = recv(fd, (char*)data + got, len - got, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+static void sendError(int conn, const char* message) {
+    DaemonResponse response = {
+        .magic = DAEMON_MAGIC, .status = -1, .len = strlen(message)};
+    sendAll(conn, &response, sizeof(response));
+    sendAll(conn, message, strlen(message));
+}
+
+// Decode the file, or the data sent with the request if fd is -1
+static uint32_t* decodeFile(int fd, const uint8_t* data, size_t len,
+                            int* img_w, int* img_h, int* alpha) {
+    FileData file = {.data = data, .len = len};
+    if (fd >= 0 && loadFileDataFd(&file, fd) != 0)
+        return NULL;
+    uint32_t* img = NULL;
+    int comp = 0;
+    if (file.len <= INT32_MAX)
+        img = (uint32_t*)stbi_load_from_memory(file.data, file.len, img_w,
+                                               img_h, &comp, 4);
+    if (fd >= 0)
+        freeFileData(&file);
+    *alpha = comp == 2 || comp == 4;
+    return img;
+}
+
+// Receive the request with the file descriptor passed along, or -1
+static int recvRequest(int conn, DaemonRequest* request, int* fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {.iov_base = request, .iov_len = sizeof(*request)};
+    struct msghdr msg = {.msg_iov = &iov,
+                         .msg_iovlen = 1,
+                         .msg_control = control,
+                         .msg_controllen = sizeof(control)};
+    *fd = -1;
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -1;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    // The rest of a request split by the socket
+    if ((size_t)n < sizeof(*request) &&
+        recvAll(conn, (char*)request + n, sizeof(*request) - n) !=
+            (ssize_t)(sizeof(*request) - n))
+        return -1;
+    return 0;
+}
+
+// Streams are read until they end, which may be never, so only regular files
+// are read by the daemon
+static int isRegularFile(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// Blended pixels of the image at the size of the request, from the
+// cache if possible. The image is the regular file fd, or the data sent with
+// the request if fd is -1. Set *owned if the caller has to free them. Return
+// NULL with the reason in *error if there are none.
+static uint32_t* getPixels(ImageCache* cache, int fd, const uint8_t* data,
+                           const DaemonRequest* request, int* w, int* h,
+                           int* owned, const char** error) {
+    *error = "Cannot decode file";
+    struct stat st = {0};
+    if (fd >= 0 && fstat(fd, &st) != 0)
+        return NULL;
+    // Data sent along cannot be told apart between requests
+    int cacheable = fd >= 0;
+    ImageKind kind = request->raw_size ? IMAGE_RAW : IMAGE_RESIZED;
+    FileKey file = {.dev = st.st_dev,
+                    .ino = st.st_ino,
+                    .size = st.st_size,
+                    .mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+                                st.st_mtim.tv_nsec};
+
+    // The size of the image is needed to find the resized one
+    CachedImage* known = cacheable ? findFile(cache, &file) : NULL;
+    if (known) {
+        *w = known->img_w;
+        *h = known->img_h;
+        if (!request->raw_size)
+            getResizeSize(&request->size, known->img_w, known->img_h, w, h);
+        CachedImage* image =
+            findImage(cache, &file, kind, *w, *h, request->background);
+        if (image) {
+            *owned = 0;
+            return image->pixels;
+        }
+    }
+
+    int img_w, img_h, alpha;
+    CachedImage* decoded = NULL;
+    if (cacheable)
+        decoded = findImage(cache, &file, IMAGE_DECODED, 0, 0, 0);
+    uint32_t* img;
+    if (decoded) {
+        img = decoded->pixels;
+        img_w = decoded->img_w;
+        img_h = decoded->img_h;
+        alpha = decoded->alpha;
+    } else {
+        img = decodeFile(fd, data, request->data_len, &img_w, &img_h,
+                         &alpha);
+        if (!img)
+            return NULL;
+    }
+
+    *w = img_w;
+    *h = img_h;
+    if (!request->raw_size)
+        getResizeSize(&request->size, img_w, img_h, w, h);
+    uint32_t* pixels = NULL;
+    if (*w <= 0 || *h <= 0 ||
+        (!request->raw_size && (int64_t)*w * *h > MAX_RESIZE_PIXELS)) {
+        *error = "Cannot resize image to the requested size";
+        goto fail;
+    }
+    *error = "Cannot allocate memory for image";
+    pixels = malloc(sizeof(uint32_t) * *w * *h);
+    if (!pixels)
+        goto fail;
+    if (request->raw_size) {
+        memcpy(pixels, img, sizeof(uint32_t) * *w * *h);
+    } else if (!stbir_resize_uint8((uint8_t*)img, img_w, img_h,
+                                   sizeof(uint32_t) * img_w, (uint8_t*)pixels,
+                                   *w, *h, sizeof(uint32_t) * *w, 4)) {
+        goto fail;
+    }
+    if (alpha) {
+        Color background = {.color = request->background};
+        blendAlpha(pixels, *w, *h, background);
+    }
+
+    // Keep both for the next request, the decoded one may be evicted to make
+    // room for the resized one. Either is only dropped if there is no memory
+    // to cache it.
+    if (!decoded) {
+        CachedImage* image =
+            cacheable ? newImage(&file, IMAGE_DECODED, img_w, img_h, img)
+                      : NULL;
+        if (image) {
+            image->img_w = img_w;
+            image->img_h = img_h;
+            image->alpha = alpha;
+            if (addImage(cache, image) != 0)
+                freeImage(image);
+        } else {
+            stbi_image_free(img);
+        }
+    }
+    *owned = 1;
+    CachedImage* image =
+        cacheable ? newImage(&file, kind, *w, *h, pixels) : NULL;
+    if (image) {
+        image->img_w = img_w;
+        image->img_h = img_h;
+        image->background = request->background;
+        if (addImage(cache, image) == 0) {
+            *owned = 0;
+        } else {
+            image->pixels = NULL;
+            freeImage(image);
+        }
+    }
+    return pixels;
+
+fail:
+    if (!decoded)
+        stbi_image_free(img);
+    free(pixels);
+    return NULL;
+}
+
+// Check the fields of the request the daemon relies on and clamp the sizes,
+// return -1 if they cannot be used
+static int checkRequest(DaemonRequest* request) {
+    SizeOptions* size = &request->size;
+    if (size->enhance_level < 0 || size->enhance_level > 2 ||
+        request->color_mode < COLOR_TRUE || request->color_mode > COLOR_NONE ||
+        size->target_w < -1 || size->target_h < -1 ||
+        size->screen_percentage < 0 || size->screen_percentage > 100 ||
+        size->screen_cols < 1 || size->screen_rows < 1)
+        return -1;
+    if (size->target_w > MAX_REQUEST_CELLS)
+        size->target_w = MAX_REQUEST_CELLS;
+    if (size->target_h > MAX_REQUEST_CELLS)
+        size->target_h = MAX_REQUEST_CELLS;
+    if (size->screen_cols > MAX_REQUEST_CELLS)
+        size->screen_cols = MAX_REQUEST_CELLS;
+    if (size->screen_rows > MAX_REQUEST_CELLS)
+        size->screen_rows = MAX_REQUEST_CELLS;
+    request->raw_size = request->raw_size != 0;
+    return 0;
+}
+
+static void serveRequest(int conn, ImageCache* cache,
+                         const RenderOptions* base, OutBuf* out) {
+    DaemonRequest request;
+    int fd;
+    uint8_t* data = NULL;
+    if (recvRequest(conn, &request, &fd) != 0 ||
+        request.magic != DAEMON_MAGIC) {
+        sendError(conn, "Invalid request");
+        goto done;
+    }
+    if (checkRequest(&request) != 0) {
+        sendError(conn, "Invalid render options");
+        goto done;
+    }
+    // Resize to the cells of the glyph set of the daemon
+    getCellSize(2, base->glyphs, &request.size.cell_w, &request.size.cell_h);
+    if (fd >= 0) {
+        if (!isRegularFile(fd)) {
+            sendError(conn, "Only regular files can be passed");
+            goto done;
+        }
+    } else if (request.data_len > 0) {
+        if (request.data_len > DAEMON_MAX_DATA) {
+            sendError(conn, "File is too large");
+            goto done;
+        }
+        data = malloc(request.data_len);
+        if (!data) {
+            sendError(conn, "Cannot allocate memory for file");
+            goto done;
+        }
+        if (recvAll(conn, data, request.data_len) !=
+            (ssize_t)request.data_len) {
+            sendError(conn, "Invalid request data");
+            goto done;
+        }
+    } else {
+        char path[MAX_PATH_LEN + 1];
+        if (request.path_len == 0 || request.path_len > MAX_PATH_LEN ||
+            recvAll(conn, path, request.path_len) !=
+                (ssize_t)request.path_len) {
+            sendError(conn, "Invalid request path");
+            goto done;
+        }
+        path[request.path_len] = '\0';
+        // A FIFO would block the open until it has a writer
+        fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (fd < 0) {
+            sendError(conn, "Cannot open file");
+            goto done;
+        }
+        if (!isRegularFile(fd)) {
+            sendError(conn, "Only regular files can be opened");
+            goto done;
+        }
+    }
+
+    int w, h, owned;
+    const char* error;
+    uint32_t* pixels =
+        getPixels(cache, fd, data, &request, &w, &h, &owned, &error);
+    if (!pixels) {
+        sendError(conn, error);
+        goto done;
+    }
+
+    RenderOptions opts = *base;
+    opts.enhance_level = request.size.enhance_level;
+    opts.color_mode = request.color_mode;
+    out->len = 0;
+    out->failed = 0;
+    int ret = renderImage(out, pixels, w, h, &opts);
+    if (owned)
+        free(pixels);
+    if (ret != 0) {
+        sendError(conn, "Cannot allocate memory for output");
+        goto done;
+    }
+
+    DaemonResponse response = {
+        .magic = DAEMON_MAGIC, .status = 0, .len = out->len};
+    if (sendAll(conn, &response, sizeof(response)) >= 0)
+        sendAll(conn, out->data, out->len);
+
+done:
+    free(data);
+    if (fd >= 0)
+        close(fd);
+}
+
+int runDaemon(const char* socket_path, const RenderOptions* opts,
+              size_t cache_bytes) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("Cannot create socket");
+        return -1;
+    }
+    // Replace a socket left by a daemon that is gone, but not a live one
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "A daemon is already listening on %s\n", socket_path);
+        close(sock);
+        return -1;
+    }
+    unlink(socket_path);
+    mode_t mask = umask(0077);
+    int ret = bind(sock, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (ret != 0 || listen(sock, SOMAXCONN) != 0) {
+        perror("Cannot listen on socket");
+        close(sock);
+        return -1;
+    }
+    socket_to_unlink = socket_path;
+    signal(SIGINT, stopDaemon);
+    signal(SIGTERM, stopDaemon);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Every color mode may be requested
+    initColorMode(COLOR_256_LUT);
+
+    ImageCache cache = {.limit = cache_bytes};
+    OutBuf out;
+    initOutBuf(&out, -1, 0);
+    for (;;) {
+        int conn = accept(sock, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("Cannot accept connection");
+            break;
+        }
+        if (!isSameUser(conn)) {
+            close(conn);
+            continue;
+        }
+        struct timeval timeout = {.tv_sec = CLIENT_TIMEOUT_SEC};
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        serveRequest(conn, &cache, opts, &out);
+        close(conn);
+    }
+
+    freeOutBuf(&out);
+    while (cache.head) {
+        CachedImage* image = cache.head;
+        unlinkImage(&cache, image);
+        freeImage(image);
+    }
+    close(sock);
+    unlink(socket_path);
+    return -1;
+}
+
+static int connectDaemon(const char* socket_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Cannot connect to daemon at %s\n", socket_path);
+        if (sock >= 0)
+            close(sock);
+        return -1;
+    }
+    if (!isSameUser(sock)) {
+        fprintf(stderr, "Daemon at %s belongs to another user\n", socket_path);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Send the request with the file descriptor, or with data_len bytes of data
+// if fd is -1
+static int sendRequest(int sock, const DaemonRequest* request, int fd,
+                       const uint8_t* data) {
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec iov = {.iov_base = (void*)request,
+                        .iov_len = sizeof(*request)};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (fd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -1;
+    // The descriptor went with the first part
+    if ((size_t)n < sizeof(*request) &&
+        sendAll(sock, (const char*)request + n, sizeof(*request) - n) < 0)
+        return -1;
+    if (fd < 0 && sendAll(sock, data, request->data_len) < 0)
+        return -1;
+    return 0;
+}
+
+// Read all of a pipe or terminal for the daemon, which only reads regular
+// files. Return NULL if it cannot be read or is larger than DAEMON_MAX_DATA.
+static uint8_t* readInput(int fd, uint32_t* len, const char* file_path) {
+    size_t cap = 1 << 16;
+    size_t got = 0;
+    uint8_t* data = malloc(cap);
+    for (;;) {
+        if (!data) {
+            fprintf(stderr, "Cannot allocate memory for %s\n", file_path);
+            return NULL;
+        }
+        ssize_t n = read(fd, data + got, cap - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            fprintf(stderr, "Cannot read file %s\n", file_path);
+            free(data);
+            return NULL;
+        }
+        if (n == 0)
+            break;
+        got += n;
+        if (got > DAEMON_MAX_DATA) {
+            fprintf(stderr, "%s is too large for the daemon\n", file_path);
+            free(data);
+            return NULL;
+        }
+        if (got == cap) {
+            cap *= 2;
+            uint8_t* grown = realloc(data, cap);
+            if (!grown)
+                free(data);
+            data = grown;
+        }
+    }
+    *len = got;
+    return data;
+}
+
+// Copy len bytes of the socket to the file descriptor. Return -1 with errno
+// set if writing fails, -2 if the socket ends before them.
+static int copyStream(int from, int to, uint64_t len) {
+    char buf[1 << 16];
+    while (len > 0) {
+        ssize_t n = recv(from, buf, len < sizeof(buf) ? len : sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -2;
+        }
+        if (n == 0)
+            return -2;
+        len -= n;
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = write(to, buf + done, n - done);
+            if (w < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            done += w;
+        }
+    }
+    return 0;
+}
+
+static int requestFile(const char* socket_path, const DaemonRequest* request,
+                       const char* file_path) {
+    int fd = STDIN_FILENO;
+    if (strcmp(file_path, "-") != 0) {
+        fd = open(file_path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Cannot open file %s\n", file_path);
+            return -1;
+        }
+    }
+
+    int ret = -1;
+    int sock = -1;
+    DaemonRequest with_data = *request;
+    uint8_t* data = NULL;
+    if (!isRegularFile(fd)) {
+        data = readInput(fd, &with_data.data_len, file_path);
+        if (!data)
+            goto done;
+        if (with_data.data_len == 0) {
+            fprintf(stderr, "%s: Cannot decode file\n", file_path);
+            goto done;
+        }
+    }
+    sock = connectDaemon(socket_path);
+    if (sock < 0)
+        goto done;
+    DaemonResponse response;
+    if (sendRequest(sock, &with_data, data ? -1 : fd, data) != 0 ||
+        recvAll(sock, &response, sizeof(response)) != sizeof(response) ||
+        response.magic != DAEMON_MAGIC) {
+        fprintf(stderr, "Cannot talk to daemon at %s\n", socket_path);
+        goto done;
+    }
+    if (response.status != 0) {
+        char message[256];
+        size_t len = response.len < sizeof(message) - 1 ? response.len
+                                                         : sizeof(message) - 1;
+        ssize_t n = recvAll(sock, message, len);
+        message[n > 0 ? n : 0] = '\0';
+        fprintf(stderr, "%s: %s\n", file_path, message);
+        goto done;
+    }
+    int copied = copyStream(sock, STDOUT_FILENO, response.len);
+    if (copied == -1) {
+        perror("Cannot write output");
+        goto done;
+    }
+    if (copied != 0) {
+        fprintf(stderr, "%s: Output from daemon was cut short\n", file_path);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    free(data);
+    if (sock >= 0)
+        close(sock);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return ret;
+}
+
+int runClient(const char* socket_path, const DaemonRequest* request,
+              char* files[], int count) {
+    for (int i = 0; i < count; i++) {
+        if (requestFile(socket_path, request, files[i]) != 0)
+            return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "render.h"
+
+#define DAEMON_MAGIC 0x35676d69  // "img5"
+// Most bytes of a file sent along with a request
+#define DAEMON_MAX_DATA (1 << 28)
+
+// Sent by the client with the file descriptor of a regular file. Without one
+// it is followed by data_len bytes of the file, read from a pipe or terminal,
+// or else by path_len bytes of the path to open.
+typedef struct DaemonRequest {
+    uint32_t magic;
+    uint32_t path_len;
+    uint32_t data_len;
+    SizeOptions size;
+    int32_t raw_size;
+    int32_t color_mode;
+    // Color transparent pixels are blended over
+    uint32_t background;
+} DaemonRequest;
+
+// Sent back before the output, or before an error message if status is not
+// 0, of len bytes
+typedef struct DaemonResponse {
+    uint32_t magic;
+    int32_t status;
+    uint64_t len;
+} DaemonResponse;
+
+// $XDG_RUNTIME_DIR/imgterm.sock, or /tmp/imgterm-<uid>.sock
+void getDaemonSocketPath(char* path, size_t size);
+
+// Serve render requests one at a time until killed. opts gives the threads
+// and caches, the size, enhance level and color mode come with each request.
+// Decoded and resized images are kept in memory up to cache_bytes.
+int runDaemon(const char* socket_path, const RenderOptions* opts,
+              size_t cache_bytes);
+
+// Render each file, or stdin for "-", through the daemon to stdout
+int runClient(const char* socket_path, const DaemonRequest* request,
+              char* files[], int count);
+
+#endif
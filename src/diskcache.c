@@ -0,0 +1,281 @@
+#include "diskcache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Change when the output for the same key changes
+#define DISKCACHE_VERSION 3
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+#define COPY_CHUNK (64 * 1024)
+
+// The directory followed by a file name
+#define CACHE_PATH_LEN (PATH_MAX + 32)
+// Temporary files this old were left by a write that was interrupted
+#define STALE_TMP_SEC 3600
+
+typedef struct CacheFile {
+    char name[32];
+    off_t size;
+    int64_t mtime_ns;
+} CacheFile;
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t len) {
+    const uint8_t* p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// FNV-1a a word at a time, the content only has to tell files apart
+static uint64_t hashWords(uint64_t hash, const uint8_t* data, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * FNV_PRIME;
+        hash ^= hash >> 29;
+    }
+    return hashBytes(hash, data + i, len - i);
+}
+
+static int makeDir(const char* path) {
+    if (mkdir(path, 0700) != 0 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+int initDiskCache(DiskCache* cache, uint64_t limit, int hash_content) {
+    cache->limit = limit;
+    cache->hash_content = hash_content;
+
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char base[PATH_MAX];
+    if (xdg && *xdg) {
+        snprintf(base, sizeof(base), "%s", xdg);
+    } else if (home && *home) {
+        snprintf(base, sizeof(base), "%s/.cache", home);
+    } else {
+        return -1;
+    }
+    int n = snprintf(cache->dir, sizeof(cache->dir), "%s/imgterm", base);
+    if (n < 0 || (size_t)n >= sizeof(cache->dir))
+        return -1;
+    if (makeDir(base) != 0 || makeDir(cache->dir) != 0)
+        return -1;
+    return 0;
+}
+
+uint64_t getDiskCacheKey(const DiskCache* cache, const FileData* file,
+                         const OutputKey* output) {
+    // Pipes cannot be told apart between runs
+    const struct stat* st = &file->st;
+    if (!S_ISREG(st->st_mode))
+        return 0;
+
+    // Hashed field by field, struct padding is not zeroed
+    int64_t fields[] = {
+        DISKCACHE_VERSION,
+        st->st_dev,
+        st->st_ino,
+        st->st_size,
+        st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec,
+        output->resize_w,
+        output->resize_h,
+        output->enhance_level,
+        output->color_mode,
+        output->background,
+        (int64_t)output->glyphs,
+    };
+    uint64_t hash = hashBytes(FNV_OFFSET, fields, sizeof(fields));
+    if (cache->hash_content)
+        hash = hashWords(hash, file->data, file->len);
+    // 0 means no key
+    return hash ? hash : 1;
+}
+
+static void getCachePath(const DiskCache* cache, uint64_t key, char* path) {
+    snprintf(path, CACHE_PATH_LEN, "%s/%016llx", cache->dir,
+             (unsigned long long)key);
+}
+
+int hasCachedOutput(const DiskCache* cache, uint64_t key) {
+    char path[CACHE_PATH_LEN];
+    getCachePath(cache, key, path);
+    return access(path, R_OK) == 0;
+}
+
+// Plain copy for outputs sendfile cannot write to
+static int copyFile(int in_fd, int out_fd) {
+    char buf[COPY_CHUNK];
+    for (;;) {
+        ssize_t n = read(in_fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n;
+        for (ssize_t done = 0; done < n;) {
+            ssize_t m = write(out_fd, buf + done, n - done);
+            if (m < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            done += m;
+        }
+    }
+}
+
+int64_t copyCachedOutput(const DiskCache* cache, uint64_t key, int fd) {
+    char path[CACHE_PATH_LEN];
+    getCachePath(cache, key, path);
+    int in_fd = open(path, O_RDONLY);
+    if (in_fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(in_fd, &st) != 0) {
+        close(in_fd);
+        return -1;
+    }
+
+    // Zero copy from the page cache to the terminal or pipe
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        ssize_t n = sendfile(fd, in_fd, &offset, st.st_size - offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (offset == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                if (copyFile(in_fd, fd) != 0)
+                    break;
+                offset = st.st_size;
+                continue;
+            }
+            break;
+        }
+        if (n == 0)
+            break;
+    }
+    if (offset < st.st_size) {
+        // Part of the output may be out already, rendering again would
+        // print it twice
+        perror("Cannot write output");
+        exit(EXIT_FAILURE);
+    }
+
+    // The modification time orders the files for eviction
+    futimens(in_fd, NULL);
+    close(in_fd);
+    return st.st_size;
+}
+
+static int compareCacheFiles(const void* a, const void* b) {
+    int64_t ta = ((const CacheFile*)a)->mtime_ns;
+    int64_t tb = ((const CacheFile*)b)->mtime_ns;
+    return (ta > tb) - (ta < tb);
+}
+
+static int isCacheName(const char* name) {
+    size_t len = strlen(name);
+    return len == 16 && strspn(name, "0123456789abcdef") == len;
+}
+
+// "<name>.<pid>.tmp" as written by storeCachedOutput before the rename
+static int isTmpName(const char* name) {
+    size_t len = strlen(name);
+    return len > 21 && strspn(name, "0123456789abcdef") == 16 &&
+           name[16] == '.' && strspn(name + 17, "0123456789") == len - 21 &&
+           strcmp(name + len - 4, ".tmp") == 0;
+}
+
+static void evictCache(const DiskCache* cache) {
+    DIR* dir = opendir(cache->dir);
+    if (!dir)
+        return;
+    CacheFile* files = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t total = 0;
+    char path[CACHE_PATH_LEN];
+    time_t now = time(NULL);
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        int tmp = isTmpName(entry->d_name);
+        if (!tmp && !isCacheName(entry->d_name))
+            continue;
+        struct stat st;
+        if (snprintf(path, sizeof(path), "%s/%s", cache->dir,
+                     entry->d_name) >= (int)sizeof(path) ||
+            stat(path, &st) != 0)
+            continue;
+        if (tmp) {
+            if (now - st.st_mtime > STALE_TMP_SEC)
+                unlink(path);
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            CacheFile* grown = realloc(files, sizeof(CacheFile) * cap);
+            if (!grown)
+                break;
+            files = grown;
+        }
+        CacheFile* file = &files[count++];
+        strcpy(file->name, entry->d_name);
+        file->size = st.st_size;
+        file->mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    if (total > cache->limit) {
+        qsort(files, count, sizeof(CacheFile), compareCacheFiles);
+        for (size_t i = 0; i < count && total > cache->limit; i++) {
+            snprintf(path, sizeof(path), "%s/%s", cache->dir,
+                     files[i].name);
+            if (unlink(path) == 0)
+                total -= files[i].size;
+        }
+    }
+    free(files);
+}
+
+void storeCachedOutput(const DiskCache* cache, uint64_t key, const char* data,
+                       size_t len) {
+    if (len > cache->limit)
+        return;
+    char path[CACHE_PATH_LEN];
+    char tmp_path[CACHE_PATH_LEN + 32];
+    getCachePath(cache, key, path);
+    // Written aside and renamed, so readers never see part of a file
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, data + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+    if (close(fd) != 0 || done < len || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return;
+    }
+    evictCache(cache);
+}
@@ -0,0 +1,50 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "filedata.h"
+
+// Rendered output kept in files named by their key, least recently used
+// files are removed once the directory grows past the limit
+typedef struct DiskCache {
+    char dir[PATH_MAX];
+    uint64_t limit;
+    // Hash the file content into the key, not only its size, inode and mtime
+    int hash_content;
+} DiskCache;
+
+// Everything else the output depends on
+typedef struct OutputKey {
+    // 0 for the raw size
+    int resize_w;
+    int resize_h;
+    int enhance_level;
+    int color_mode;
+    // Color of the background blended into transparent pixels
+    uint32_t background;
+    // Id of the glyph set matched at enhance level 2
+    uint64_t glyphs;
+} OutputKey;
+
+// Use $XDG_CACHE_HOME/imgterm, or ~/.cache/imgterm, creating it if needed
+int initDiskCache(DiskCache* cache, uint64_t limit, int hash_content);
+
+// Key of the file rendered with the options, 0 if it is not a regular file
+uint64_t getDiskCacheKey(const DiskCache* cache, const FileData* file,
+                         const OutputKey* output);
+
+// Whether there is an output for the key, it may still be evicted before it
+// is copied
+int hasCachedOutput(const DiskCache* cache, uint64_t key);
+
+// Copy the cached output to fd, return -1 if there is none
+int64_t copyCachedOutput(const DiskCache* cache, uint64_t key, int fd);
+
+// Save the output, then evict the oldest files over the limit
+void storeCachedOutput(const DiskCache* cache, uint64_t key, const char* data,
+                       size_t len);
+
+#endif
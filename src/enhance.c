@@ -1,171 +1,234 @@
-#include <stdio.h>
+#include "enhance.h"
+
+#include <pthread.h>
 
 #include "color.h"
+#include "match.h"
 
-static uint32_t bitmap[] = {
-    0x00000000, 0x00a0,
-
-    // Block graphics
-    // 0xffff0000, 0x2580,  // upper 1/2; redundant with inverse lower 1/2
-
-    0x0000000f, 0x2581,  // lower 1/8
-    0x000000ff, 0x2582,  // lower 1/4
-    0x00000fff, 0x2583,  //
-    0x0000ffff, 0x2584,  // lower 1/2
-    0x000fffff, 0x2585,  //
-    0x00ffffff, 0x2586,  // lower 3/4
-    0x0fffffff, 0x2587,  //
-    // 0xffffffff, 0x2588,  // full; redundant with inverse space
-
-    0xeeeeeeee, 0x258a,  // left 3/4
-    0xcccccccc, 0x258c,  // left 1/2
-    0x88888888, 0x258e,  // left 1/4
-
-    0x0000cccc, 0x2596,  // quadrant lower left
-    0x00003333, 0x2597,  // quadrant lower right
-    0xcccc0000, 0x2598,  // quadrant upper left
-    // 0xccccffff, 0x2599,  // 3/4 redundant with inverse 1/4
-    0xcccc3333, 0x259a,  // diagonal 1/2
-                         // 0xffffcccc, 0x259b,  // 3/4 redundant
-    // 0xffff3333, 0x259c,  // 3/4 redundant
-    0x33330000, 0x259d,  // quadrant upper right
-                         // 0x3333cccc, 0x259e,  // 3/4 redundant
-    // 0x3333ffff, 0x259f,  // 3/4 redundant
-
-    // Line drawing subset: no double lines, no complex light lines
-
-    0x000ff000, 0x2501,  // Heavy horizontal
-    0x66666666, 0x2503,  // Heavy vertical
-
-    0x00077666, 0x250f,  // Heavy down and right
-    0x000ee666, 0x2513,  // Heavy down and left
-    0x66677000, 0x2517,  // Heavy up and right
-    0x666ee000, 0x251b,  // Heavy up and left
-
-    0x66677666, 0x2523,  // Heavy vertical and right
-    0x666ee666, 0x252b,  // Heavy vertical and left
-    0x000ff666, 0x2533,  // Heavy down and horizontal
-    0x666ff000, 0x253b,  // Heavy up and horizontal
-    0x666ff666, 0x254b,  // Heavy cross
-
-    0x000cc000, 0x2578,  // Bold horizontal left
-    0x00066000, 0x2579,  // Bold horizontal up
-    0x00033000, 0x257a,  // Bold horizontal right
-    0x00066000, 0x257b,  // Bold horizontal down
-
-    0x06600660, 0x254f,  // Heavy double dash vertical
-
-    0x000f0000, 0x2500,  // Light horizontal
-    0x0000f000, 0x2500,  //
-    0x44444444, 0x2502,  // Light vertical
-    0x22222222, 0x2502,  //
-
-    0x000e0000, 0x2574,  // light left
-    0x0000e000, 0x2574,  // light left
-    0x44440000, 0x2575,  // light up
-    0x22220000, 0x2575,  // light up
-    0x00030000, 0x2576,  // light right
-    0x00003000, 0x2576,  // light right
-    0x00004444, 0x2577,  // light down
-    0x00002222, 0x2577,  // light down
-
-    // Misc technical
-
-    0x44444444, 0x23a2,  // [ extension
-    0x22222222, 0x23a5,  // ] extension
-
-    0x0f000000, 0x23ba,  // Horizontal scanline 1
-    0x00f00000, 0x23bb,  // Horizontal scanline 3
-    0x00000f00, 0x23bc,  // Horizontal scanline 7
-    0x000000f0, 0x23bd,  // Horizontal scanline 9
-
-    // Geometrical shapes. Tricky because some of them are too wide.
-
-    // 0x00ffff00, 0x25fe,  // Black medium small square
-    0x00066000, 0x25aa,  // Black small square
-};
-
-static uint32_t getPixelsDist(Color p1[8][4], Color p2[8][4]) {
-    uint32_t dist = 0;
-    for (int x = 0; x < 8; x++) {
-        for (int y = 0; y < 4; y++) {
-            dist += getColorSqrDist(p1[x][y], p2[x][y]);
-        }
+static MatchFunc match = matchScalar;
+static WideMatchFunc wide_match = matchWideScalar;
+
+// Channel sums of up to 32 pixels are packed into 21-bit lanes so that a single
+// 64-bit add accumulates r, g and b at once.
+#define LANE_BITS 21
+#define LANE_MASK ((1u << LANE_BITS) - 1)
+
+static inline uint64_t packColor(Color c) {
+    return (uint64_t)c.r | (uint64_t)c.g << LANE_BITS |
+           (uint64_t)c.b << (2 * LANE_BITS);
+}
+
+// Distance contribution of a group filled with its (truncated) average color.
+// Sum of (p - m)^2 over the group is sum(p^2) - 2 * m * sum(p) + n * m^2, the
+// sum(p^2) part is the same for every glyph and is added by the caller.
+static int getGroupDist(uint64_t sum, int count, Color* avg) {
+    if (!count)
+        return 0;
+    int dist = 0;
+    uint8_t* channels[3] = {&avg->r, &avg->g, &avg->b};
+    for (int c = 0; c < 3; c++) {
+        int s = (sum >> (c * LANE_BITS)) & LANE_MASK;
+        int m = s / count;
+        *channels[c] = m;
+        dist += m * (count * m - 2 * s);
     }
     return dist;
 }
 
-static inline int getBit4x8(uint32_t mask, int x, int y) {
-    return (mask >> (31 - (x * 4 + y))) & 1;
+uint32_t getWideSqrSum(const Color* pixels, int count) {
+    uint32_t sqr_sum = 0;
+    for (int i = 0; i < count; i++) {
+        Color c = pixels[i];
+        sqr_sum += c.r * c.r + c.g * c.g + c.b * c.b;
+    }
+    return sqr_sum;
 }
 
-static void printUnicode(uint32_t codepoint) {
-    if (codepoint < 128) {
-        printf("%c", (char)codepoint);
-    } else if (codepoint < 0x7ff) {
-        printf("%c%c", (char)(0xc0 | (codepoint >> 6)),
-               (char)(0x80 | (codepoint & 0x3f)));
-    } else if (codepoint < 0xffff) {
-        printf("%c%c%c", (char)(0xe0 | (codepoint >> 12)),
-               (char)(0x80 | ((codepoint >> 6) & 0x3f)),
-               (char)(0x80 | (codepoint & 0x3f)));
-    } else if (codepoint < 0x10ffff) {
-        printf("%c%c%c%c", (char)(0xf0 | (codepoint >> 18)),
-               (char)(0x80 | ((codepoint >> 12) & 0x3f)),
-               (char)(0x80 | ((codepoint >> 6) & 0x3f)),
-               (char)(0x80 | (codepoint & 0x3f)));
-    }
+uint32_t getCellSqrSum(Color pixels[8][4]) {
+    return getWideSqrSum(&pixels[0][0], 32);
 }
 
-void printClosestShape(Color pixels[8][4], SetColorFunc setColor) {
-    uint32_t min_dist = UINT32_MAX;
-    uint32_t symbol = 0x00a0;
-    Color result_colors[2] = {0};
-
-    // Find the closest symbol and colors
-    for (size_t i = 0; i < sizeof(bitmap) / sizeof(uint32_t); i += 2) {
-        int mask = bitmap[i];
-        // Calculate the average color of fg and bg
-        int r_sum[2] = {0}, g_sum[2] = {0}, b_sum[2] = {0}, count[2] = {0};
-        for (int x = 0; x < 8; x++) {
-            for (int y = 0; y < 4; y++) {
-                int group = getBit4x8(mask, x, y);
-                r_sum[group] += pixels[x][y].r;
-                g_sum[group] += pixels[x][y].g;
-                b_sum[group] += pixels[x][y].b;
-                count[group]++;
-            }
+void getGlyphColors(uint32_t mask, Color pixels[8][4], Color colors[2]) {
+    uint64_t sums[2] = {0};
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 4; y++) {
+            sums[(mask >> (31 - (x * 4 + y))) & 1] += packColor(pixels[x][y]);
         }
+    }
+    int fg_count = __builtin_popcount(mask);
+    colors[0].color = colors[1].color = 0;
+    getGroupDist(sums[0], 32 - fg_count, &colors[0]);
+    getGroupDist(sums[1], fg_count, &colors[1]);
+}
 
-        Color colors[2];
-        if (count[0]) {
-            colors[0].r = r_sum[0] / count[0];
-            colors[0].g = g_sum[0] / count[0];
-            colors[0].b = b_sum[0] / count[0];
+void getWideGlyphColors(const MatchTable* table, size_t index,
+                        const Color* pixels, Color colors[2]) {
+    uint64_t sums[2] = {0};
+    for (int w = 0; w < table->words; w++) {
+        uint32_t mask = table->masks[w * table->stride + index];
+        for (int b = 0; b < 32; b++) {
+            sums[(mask >> (31 - b)) & 1] += packColor(pixels[w * 32 + b]);
         }
-        if (count[1]) {
-            colors[1].r = r_sum[1] / count[1];
-            colors[1].g = g_sum[1] / count[1];
-            colors[1].b = b_sum[1] / count[1];
+    }
+    colors[0].color = colors[1].color = 0;
+    getGroupDist(sums[0], table->bg_count[index], &colors[0]);
+    getGroupDist(sums[1], table->fg_count[index], &colors[1]);
+}
+
+// Sums of the 4 pixels of each hex digit of a mask, indexed by the digit,
+// return the sum of all of them
+static inline uint64_t getNibbleSums(const Color* pixels, int nibbles,
+                                     uint64_t sums[][16]) {
+    uint64_t total = 0;
+    for (int k = 0; k < nibbles; k++) {
+        sums[k][0] = 0;
+        for (int n = 1; n < 16; n++) {
+            // Bit 3 of the digit is the leftmost pixel
+            Color c = pixels[k * 4 + 3 - __builtin_ctz(n)];
+            sums[k][n] = sums[k][n & (n - 1)] + packColor(c);
         }
+        total += sums[k][15];
+    }
+    return total;
+}
 
-        // Calculate the distance between the result and the original
-        Color result_pixels[8][4];
-        for (int x = 0; x < 8; x++) {
-            for (int y = 0; y < 4; y++) {
-                int group = getBit4x8(mask, x, y);
-                result_pixels[x][y] = colors[group];
-            }
+static inline uint64_t getMaskSum(const MatchTable* table, size_t index,
+                                  int words, uint64_t sums[][16]) {
+    uint64_t sum = 0;
+    for (int w = 0; w < words; w++) {
+        uint32_t mask = table->masks[w * table->stride + index];
+        for (int k = 0; k < 8; k++) {
+            sum += sums[w * 8 + k][(mask >> (28 - k * 4)) & 0xf];
         }
-        uint32_t dist = getPixelsDist(result_pixels, pixels);
-        if (dist < min_dist) {
-            symbol = bitmap[i + 1];
-            result_colors[0] = colors[0];
-            result_colors[1] = colors[1];
+    }
+    return sum;
+}
+
+// Squared length of the (r, g, b) sum vector
+static inline int64_t getSqrLength(uint64_t sum) {
+    int64_t len = 0;
+    for (int c = 0; c < 3; c++) {
+        int64_t s = (sum >> (c * LANE_BITS)) & LANE_MASK;
+        len += s * s;
+    }
+    return len;
+}
+
+// Shared by the scalar matchers, words is a constant for the 4x8 one so the
+// loops over words go away
+static inline size_t searchGlyphs(const MatchTable* table,
+                                  const Color* pixels, int words, size_t hint,
+                                  Color colors[2]) {
+    uint64_t sums[MATCH_MAX_WORDS * 8][16];
+    uint64_t total = getNibbleSums(pixels, words * 8, sums);
+    uint32_t sqr_sum = getWideSqrSum(pixels, words * 32);
+
+    // Start from the hint, a good guess makes the bound below tight early
+    if (hint >= table->count)
+        hint = 0;
+    size_t index = hint;
+    uint64_t fg_sum = getMaskSum(table, hint, words, sums);
+    colors[0].color = colors[1].color = 0;
+    uint32_t min_dist = sqr_sum;
+    min_dist += getGroupDist(total - fg_sum, table->bg_count[hint], &colors[0]);
+    min_dist += getGroupDist(fg_sum, table->fg_count[hint], &colors[1]);
+
+    for (size_t i = 0; i < table->count; i++) {
+        if (i == hint)
+            continue;
+        fg_sum = getMaskSum(table, i, words, sums);
+        uint64_t bg_sum = total - fg_sum;
+        int fg_count = table->fg_count[i];
+        int bg_count = table->bg_count[i];
+
+        // With exact averages the distance would be
+        // sqr_sum - |fg_sum|^2 / fg_count - |bg_sum|^2 / bg_count, truncating
+        // them only makes it larger. Skip the glyph if this lower bound cannot
+        // win, compared multiplied by both counts to avoid dividing.
+        // An empty group has a zero sum, use a count of 1 for it.
+        int64_t fg_n = fg_count ? fg_count : 1;
+        int64_t bg_n = bg_count ? bg_count : 1;
+        int64_t bound = ((int64_t)sqr_sum - min_dist) * fg_n * bg_n -
+                        getSqrLength(fg_sum) * bg_n -
+                        getSqrLength(bg_sum) * fg_n;
+        if (bound > 0 || (bound == 0 && i > index))
+            continue;
+
+        // Calculate the average color of fg and bg, and the distance between
+        // the result and the original
+        Color avg[2] = {0};
+        uint32_t dist = sqr_sum;
+        dist += getGroupDist(bg_sum, bg_count, &avg[0]);
+        dist += getGroupDist(fg_sum, fg_count, &avg[1]);
+        // Ties go to the first glyph in the table
+        if (dist < min_dist || (dist == min_dist && i < index)) {
+            index = i;
+            colors[0] = avg[0];
+            colors[1] = avg[1];
             min_dist = dist;
         }
     }
-    setColor(result_colors[0].color, 1);
-    setColor(result_colors[1].color, 0);
-    printUnicode(symbol);
+    return index;
+}
+
+size_t matchScalar(const MatchTable* table, Color pixels[8][4], size_t hint,
+                   Color colors[2]) {
+    return searchGlyphs(table, &pixels[0][0], 1, hint, colors);
+}
+
+size_t matchWideScalar(const MatchTable* table, const Color* pixels,
+                       size_t hint, Color colors[2]) {
+    return searchGlyphs(table, pixels, table->words, hint, colors);
+}
+
+static pthread_once_t enhance_once = PTHREAD_ONCE_INIT;
+
+static void buildEnhance(void) {
+    getDefaultGlyphSet();
+
+    match = matchScalar;
+    wide_match = matchWideScalar;
+#ifdef MATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        match = matchAVX2;
+        wide_match = matchWideAVX2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        match = matchSSE41;
+        wide_match = matchWideSSE41;
+    }
+#endif
+}
+
+void initEnhance(void) { pthread_once(&enhance_once, buildEnhance); }
+
+size_t findClosestShape(const GlyphSet* glyphs, CellCache* cache,
+                        size_t* hint, Color pixels[8][4], Color colors[2]) {
+    size_t index;
+    int hit = 0;
+    CellCacheEntry* entry = cache ? lookupCellCache(cache, pixels, &hit) : NULL;
+    if (hit) {
+        index = entry->glyph;
+        colors[0] = entry->colors[0];
+        colors[1] = entry->colors[1];
+    } else {
+        const MatchTable* table = &glyphs->table;
+        size_t start = *hint < table->count ? *hint : glyphs->half_block;
+        index = match(table, pixels, start, colors);
+        if (entry) {
+            entry->glyph = index;
+            entry->colors[0] = colors[0];
+            entry->colors[1] = colors[1];
+        }
+    }
+    *hint = index;
+    return index;
+}
+
+size_t findClosestWideShape(const GlyphSet* glyphs, size_t* hint,
+                            const Color* pixels, Color colors[2]) {
+    const MatchTable* table = &glyphs->table;
+    size_t start = *hint < table->count ? *hint : glyphs->half_block;
+    *hint = wide_match(table, pixels, start, colors);
+    return *hint;
 }
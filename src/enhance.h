@@ -1,6 +1,27 @@
 #ifndef ENHANCE_H
 #define ENHANCE_H
 
-void printClosestShape(Color pixels[8][4], SetColorFunc setColor);
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cellcache.h"
+#include "color.h"
+#include "glyphs.h"
+
+// Build the default glyph set and pick the fastest matcher for this CPU, only
+// the first call does anything
+void initEnhance(void);
+// Start of a row for the glyph hint
+#define NO_GLYPH_HINT SIZE_MAX
+
+// Return the index of the closest glyph and store its bg and fg colors.
+// cache may be NULL, and must only hold cells matched with the same glyphs.
+// hint is the glyph of the left cell and is updated to the glyph of this one.
+size_t findClosestShape(const GlyphSet* glyphs, CellCache* cache,
+                        size_t* hint, Color pixels[8][4], Color colors[2]);
+// Same for glyph sets of more than one word per mask, with the pixels of the
+// cell in rows from the top left. Not cached.
+size_t findClosestWideShape(const GlyphSet* glyphs, size_t* hint,
+                            const Color* pixels, Color colors[2]);
 
 #endif
@@ -0,0 +1,407 @@
+#include "match.h"
+
+#ifdef MATCH_X86
+
+#include <immintrin.h>
+
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+// The vector matchers evaluate a batch of glyphs per pass, one glyph per lane.
+// Each pixel is broadcast to all lanes and added to the lanes whose mask has
+// the pixel set. Red and blue sums fit in 16 bits, so they share a lane.
+static void splitPixels(Color pixels[8][4], uint32_t rb[32], uint32_t g[32],
+                        uint32_t* rb_total, uint32_t* g_total) {
+    *rb_total = *g_total = 0;
+    for (int x = 0; x < 8; x++) {
+        for (int y = 0; y < 4; y++) {
+            Color c = pixels[x][y];
+            rb[x * 4 + y] = c.r | (uint32_t)c.b << 16;
+            g[x * 4 + y] = c.g;
+            *rb_total += rb[x * 4 + y];
+            *g_total += c.g;
+        }
+    }
+}
+
+// Pick the first glyph of the batch that beats min_dist, in table order
+static void updateMin(const uint32_t* dists, size_t base, size_t count,
+                      uint32_t* min_dist, size_t* index) {
+    for (size_t j = 0; j < count; j++) {
+        if (dists[j] < *min_dist) {
+            *min_dist = dists[j];
+            *index = base + j;
+        }
+    }
+}
+
+// m * (n * m - 2 * s) with m = s / n, see getGroupDist
+static inline TARGET_SSE41 __m128i groupDistSSE41(__m128i sum, __m128i count,
+                                                  __m128i recip) {
+    __m128i m =
+        _mm_srli_epi32(_mm_mullo_epi32(sum, recip), MATCH_RECIP_SHIFT);
+    __m128i t =
+        _mm_sub_epi32(_mm_mullo_epi32(count, m), _mm_add_epi32(sum, sum));
+    return _mm_mullo_epi32(m, t);
+}
+
+TARGET_SSE41 size_t matchSSE41(const MatchTable* table, Color pixels[8][4],
+                               size_t hint, Color colors[2]) {
+    (void)hint;
+    uint32_t rb[32], g[32], rb_total, g_total;
+    splitPixels(pixels, rb, g, &rb_total, &g_total);
+    __m128i sqr_sum = _mm_set1_epi32(getCellSqrSum(pixels));
+    __m128i lo16 = _mm_set1_epi32(0xffff);
+
+    uint32_t min_dist = UINT32_MAX;
+    size_t index = 0;
+    for (size_t i = 0; i < table->count; i += 4) {
+        __m128i masks = _mm_loadu_si128((const __m128i*)&table->masks[i]);
+        __m128i fg_rb = _mm_setzero_si128();
+        __m128i fg_g = _mm_setzero_si128();
+        for (int k = 0; k < 32; k++) {
+            // The sign bit selects the pixel, then shift in the next one
+            __m128i sel = _mm_srai_epi32(masks, 31);
+            masks = _mm_add_epi32(masks, masks);
+            fg_rb = _mm_add_epi32(fg_rb,
+                                  _mm_and_si128(sel, _mm_set1_epi32(rb[k])));
+            fg_g =
+                _mm_add_epi32(fg_g, _mm_and_si128(sel, _mm_set1_epi32(g[k])));
+        }
+        __m128i bg_rb = _mm_sub_epi32(_mm_set1_epi32(rb_total), fg_rb);
+        __m128i bg_g = _mm_sub_epi32(_mm_set1_epi32(g_total), fg_g);
+
+        __m128i n = _mm_loadu_si128((const __m128i*)&table->fg_count[i]);
+        __m128i recip = _mm_loadu_si128((const __m128i*)&table->fg_recip[i]);
+        __m128i dist = sqr_sum;
+        dist = _mm_add_epi32(
+            dist, groupDistSSE41(_mm_and_si128(fg_rb, lo16), n, recip));
+        dist = _mm_add_epi32(
+            dist, groupDistSSE41(_mm_srli_epi32(fg_rb, 16), n, recip));
+        dist = _mm_add_epi32(dist, groupDistSSE41(fg_g, n, recip));
+
+        n = _mm_loadu_si128((const __m128i*)&table->bg_count[i]);
+        recip = _mm_loadu_si128((const __m128i*)&table->bg_recip[i]);
+        dist = _mm_add_epi32(
+            dist, groupDistSSE41(_mm_and_si128(bg_rb, lo16), n, recip));
+        dist = _mm_add_epi32(
+            dist, groupDistSSE41(_mm_srli_epi32(bg_rb, 16), n, recip));
+        dist = _mm_add_epi32(dist, groupDistSSE41(bg_g, n, recip));
+
+        uint32_t dists[4];
+        _mm_storeu_si128((__m128i*)dists, dist);
+        size_t count = table->count - i < 4 ? table->count - i : 4;
+        updateMin(dists, i, count, &min_dist, &index);
+    }
+    getGlyphColors(table->masks[index], pixels, colors);
+    return index;
+}
+
+static inline TARGET_AVX2 __m256i groupDistAVX2(__m256i sum, __m256i count,
+                                                __m256i recip) {
+    __m256i m =
+        _mm256_srli_epi32(_mm256_mullo_epi32(sum, recip), MATCH_RECIP_SHIFT);
+    __m256i t = _mm256_sub_epi32(_mm256_mullo_epi32(count, m),
+                                 _mm256_add_epi32(sum, sum));
+    return _mm256_mullo_epi32(m, t);
+}
+
+TARGET_AVX2 size_t matchAVX2(const MatchTable* table, Color pixels[8][4],
+                             size_t hint, Color colors[2]) {
+    (void)hint;
+    uint32_t rb[32], g[32], rb_total, g_total;
+    splitPixels(pixels, rb, g, &rb_total, &g_total);
+    __m256i sqr_sum = _mm256_set1_epi32(getCellSqrSum(pixels));
+    __m256i lo16 = _mm256_set1_epi32(0xffff);
+
+    uint32_t min_dist = UINT32_MAX;
+    size_t index = 0;
+    for (size_t i = 0; i < table->count; i += 8) {
+        __m256i masks = _mm256_loadu_si256((const __m256i*)&table->masks[i]);
+        __m256i fg_rb = _mm256_setzero_si256();
+        __m256i fg_g = _mm256_setzero_si256();
+        for (int k = 0; k < 32; k++) {
+            // The sign bit selects the pixel, then shift in the next one
+            __m256i sel = _mm256_srai_epi32(masks, 31);
+            masks = _mm256_add_epi32(masks, masks);
+            fg_rb = _mm256_add_epi32(
+                fg_rb, _mm256_and_si256(sel, _mm256_set1_epi32(rb[k])));
+            fg_g = _mm256_add_epi32(
+                fg_g, _mm256_and_si256(sel, _mm256_set1_epi32(g[k])));
+        }
+        __m256i bg_rb = _mm256_sub_epi32(_mm256_set1_epi32(rb_total), fg_rb);
+        __m256i bg_g = _mm256_sub_epi32(_mm256_set1_epi32(g_total), fg_g);
+
+        __m256i n = _mm256_loadu_si256((const __m256i*)&table->fg_count[i]);
+        __m256i recip =
+            _mm256_loadu_si256((const __m256i*)&table->fg_recip[i]);
+        __m256i dist = sqr_sum;
+        dist = _mm256_add_epi32(
+            dist, groupDistAVX2(_mm256_and_si256(fg_rb, lo16), n, recip));
+        dist = _mm256_add_epi32(
+            dist, groupDistAVX2(_mm256_srli_epi32(fg_rb, 16), n, recip));
+        dist = _mm256_add_epi32(dist, groupDistAVX2(fg_g, n, recip));
+
+        n = _mm256_loadu_si256((const __m256i*)&table->bg_count[i]);
+        recip = _mm256_loadu_si256((const __m256i*)&table->bg_recip[i]);
+        dist = _mm256_add_epi32(
+            dist, groupDistAVX2(_mm256_and_si256(bg_rb, lo16), n, recip));
+        dist = _mm256_add_epi32(
+            dist, groupDistAVX2(_mm256_srli_epi32(bg_rb, 16), n, recip));
+        dist = _mm256_add_epi32(dist, groupDistAVX2(bg_g, n, recip));
+
+        uint32_t dists[8];
+        _mm256_storeu_si256((__m256i*)dists, dist);
+        size_t count = table->count - i < 8 ? table->count - i : 8;
+        updateMin(dists, i, count, &min_dist, &index);
+    }
+    getGlyphColors(table->masks[index], pixels, colors);
+    return index;
+}
+
+// The wide matchers look up the sums of the pixels of each hex digit of the
+// masks with pshufb, for a whole batch of glyphs at once. A per-cell table
+// holds the 16 sums of a digit for each channel, split into low and high
+// bytes. The sums of a cell fit in 16 bits.
+typedef struct NibbleTables {
+    // Low bytes of the 16 sums then high bytes, per digit and channel
+    uint8_t bytes[MATCH_MAX_WORDS * 8][3][32];
+} NibbleTables;
+
+static void splitChannels(const Color* pixels, int count,
+                          uint16_t channels[3][MATCH_MAX_PIXELS],
+                          uint32_t totals[3]) {
+    totals[0] = totals[1] = totals[2] = 0;
+    for (int i = 0; i < count; i++) {
+        Color c = pixels[i];
+        channels[0][i] = c.r;
+        channels[1][i] = c.g;
+        channels[2][i] = c.b;
+        totals[0] += c.r;
+        totals[1] += c.g;
+        totals[2] += c.b;
+    }
+}
+
+// s / n is exact in floats for the sums and counts of a cell, so truncating
+// it gives the integer quotient. An empty group has a zero sum.
+static inline TARGET_SSE41 __m128i wideGroupDistSSE41(__m128i sum,
+                                                      __m128i count) {
+    __m128 n = _mm_cvtepi32_ps(_mm_max_epi32(count, _mm_set1_epi32(1)));
+    __m128i m = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(sum), n));
+    __m128i t =
+        _mm_sub_epi32(_mm_mullo_epi32(count, m), _mm_add_epi32(sum, sum));
+    return _mm_mullo_epi32(m, t);
+}
+
+static TARGET_SSE41 void buildNibbleTablesSSE41(
+    uint16_t channels[3][MATCH_MAX_PIXELS], int nibbles,
+    NibbleTables* tables) {
+    // Lanes of digits 0 to 7 and 8 to 15 that have pixel j set, bit 3 of a
+    // digit is its leftmost pixel
+    __m128i sel[2][4];
+    for (int j = 0; j < 4; j++) {
+        int16_t bits[16];
+        for (int n = 0; n < 16; n++) {
+            bits[n] = (n >> (3 - j)) & 1 ? -1 : 0;
+        }
+        sel[0][j] = _mm_loadu_si128((const __m128i*)&bits[0]);
+        sel[1][j] = _mm_loadu_si128((const __m128i*)&bits[8]);
+    }
+    __m128i lo8 = _mm_set1_epi16(0xff);
+    for (int k = 0; k < nibbles; k++) {
+        for (int c = 0; c < 3; c++) {
+            __m128i sums[2];
+            for (int h = 0; h < 2; h++) {
+                sums[h] = _mm_setzero_si128();
+                for (int j = 0; j < 4; j++) {
+                    __m128i p = _mm_set1_epi16(channels[c][k * 4 + j]);
+                    sums[h] = _mm_add_epi16(sums[h],
+                                            _mm_and_si128(sel[h][j], p));
+                }
+            }
+            __m128i lo = _mm_packus_epi16(_mm_and_si128(sums[0], lo8),
+                                          _mm_and_si128(sums[1], lo8));
+            __m128i hi = _mm_packus_epi16(_mm_srli_epi16(sums[0], 8),
+                                          _mm_srli_epi16(sums[1], 8));
+            _mm_storeu_si128((__m128i*)&tables->bytes[k][c][0], lo);
+            _mm_storeu_si128((__m128i*)&tables->bytes[k][c][16], hi);
+        }
+    }
+}
+
+TARGET_SSE41 size_t matchWideSSE41(const MatchTable* table,
+                                   const Color* pixels, size_t hint,
+                                   Color colors[2]) {
+    (void)hint;
+    int nibbles = table->words * 8;
+    uint16_t channels[3][MATCH_MAX_PIXELS];
+    uint32_t totals[3];
+    splitChannels(pixels, table->words * 32, channels, totals);
+    NibbleTables tables;
+    buildNibbleTablesSSE41(channels, nibbles, &tables);
+    __m128i sqr_sum =
+        _mm_set1_epi32(getWideSqrSum(pixels, table->words * 32));
+
+    uint32_t min_dist = UINT32_MAX;
+    size_t index = 0;
+    // Half of a wide batch per pass, the stride is a multiple of it
+    for (size_t i = 0; i < table->count; i += 16) {
+        // Channel sums of glyphs 0 to 7 and 8 to 15 of the pass
+        __m128i fg[3][2];
+        for (int c = 0; c < 3; c++) {
+            fg[c][0] = fg[c][1] = _mm_setzero_si128();
+        }
+        for (int k = 0; k < nibbles; k++) {
+            __m128i digits = _mm_loadu_si128(
+                (const __m128i*)&table->nibbles[k * table->stride + i]);
+            for (int c = 0; c < 3; c++) {
+                const uint8_t* bytes = tables.bytes[k][c];
+                __m128i lo = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)&bytes[0]), digits);
+                __m128i hi = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)&bytes[16]), digits);
+                fg[c][0] = _mm_add_epi16(fg[c][0], _mm_unpacklo_epi8(lo, hi));
+                fg[c][1] = _mm_add_epi16(fg[c][1], _mm_unpackhi_epi8(lo, hi));
+            }
+        }
+
+        // Glyphs 4 at a time, in table order
+        for (int g = 0; g < 4 && i + g * 4 < table->count; g++) {
+            size_t base = i + g * 4;
+            __m128i n = _mm_loadu_si128((const __m128i*)&table->fg_count[base]);
+            __m128i bg_n =
+                _mm_loadu_si128((const __m128i*)&table->bg_count[base]);
+            __m128i dist = sqr_sum;
+            for (int c = 0; c < 3; c++) {
+                __m128i sums = fg[c][g / 2];
+                if (g & 1)
+                    sums = _mm_srli_si128(sums, 8);
+                __m128i fg_sum = _mm_cvtepu16_epi32(sums);
+                __m128i bg_sum =
+                    _mm_sub_epi32(_mm_set1_epi32(totals[c]), fg_sum);
+                dist = _mm_add_epi32(dist, wideGroupDistSSE41(fg_sum, n));
+                dist = _mm_add_epi32(dist, wideGroupDistSSE41(bg_sum, bg_n));
+            }
+            uint32_t dists[4];
+            _mm_storeu_si128((__m128i*)dists, dist);
+            size_t count = table->count - base < 4 ? table->count - base : 4;
+            updateMin(dists, base, count, &min_dist, &index);
+        }
+    }
+    getWideGlyphColors(table, index, pixels, colors);
+    return index;
+}
+
+static inline TARGET_AVX2 __m256i wideGroupDistAVX2(__m256i sum,
+                                                    __m256i count) {
+    __m256 n =
+        _mm256_cvtepi32_ps(_mm256_max_epi32(count, _mm256_set1_epi32(1)));
+    __m256i m = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(sum), n));
+    __m256i t = _mm256_sub_epi32(_mm256_mullo_epi32(count, m),
+                                 _mm256_add_epi32(sum, sum));
+    return _mm256_mullo_epi32(m, t);
+}
+
+static TARGET_AVX2 void buildNibbleTablesAVX2(
+    uint16_t channels[3][MATCH_MAX_PIXELS], int nibbles,
+    NibbleTables* tables) {
+    // Lanes of the 16 digits that have pixel j set
+    __m256i sel[4];
+    for (int j = 0; j < 4; j++) {
+        int16_t bits[16];
+        for (int n = 0; n < 16; n++) {
+            bits[n] = (n >> (3 - j)) & 1 ? -1 : 0;
+        }
+        sel[j] = _mm256_loadu_si256((const __m256i*)bits);
+    }
+    __m256i lo8 = _mm256_set1_epi16(0xff);
+    for (int k = 0; k < nibbles; k++) {
+        for (int c = 0; c < 3; c++) {
+            __m256i sums = _mm256_setzero_si256();
+            for (int j = 0; j < 4; j++) {
+                __m256i p = _mm256_set1_epi16(channels[c][k * 4 + j]);
+                sums = _mm256_add_epi16(sums, _mm256_and_si256(sel[j], p));
+            }
+            // Packing works within 128-bit lanes, put the low bytes of all
+            // 16 sums in the first lane and the high bytes in the second
+            __m256i bytes = _mm256_packus_epi16(_mm256_and_si256(sums, lo8),
+                                                _mm256_srli_epi16(sums, 8));
+            bytes = _mm256_permute4x64_epi64(bytes, 0xd8);
+            _mm256_storeu_si256((__m256i*)tables->bytes[k][c], bytes);
+        }
+    }
+}
+
+TARGET_AVX2 size_t matchWideAVX2(const MatchTable* table, const Color* pixels,
+                                 size_t hint, Color colors[2]) {
+    (void)hint;
+    int nibbles = table->words * 8;
+    uint16_t channels[3][MATCH_MAX_PIXELS];
+    uint32_t totals[3];
+    splitChannels(pixels, table->words * 32, channels, totals);
+    NibbleTables tables;
+    buildNibbleTablesAVX2(channels, nibbles, &tables);
+    __m256i sqr_sum =
+        _mm256_set1_epi32(getWideSqrSum(pixels, table->words * 32));
+
+    uint32_t min_dist = UINT32_MAX;
+    size_t index = 0;
+    for (size_t i = 0; i < table->count; i += MATCH_WIDE_BATCH) {
+        // Unpacking works within 128-bit lanes, so the first sums are of
+        // glyphs 0 to 7 and 16 to 23 of the batch, the second of 8 to 15 and
+        // 24 to 31
+        __m256i fg[3][2];
+        for (int c = 0; c < 3; c++) {
+            fg[c][0] = fg[c][1] = _mm256_setzero_si256();
+        }
+        for (int k = 0; k < nibbles; k++) {
+            __m256i digits = _mm256_loadu_si256(
+                (const __m256i*)&table->nibbles[k * table->stride + i]);
+            for (int c = 0; c < 3; c++) {
+                const uint8_t* bytes = tables.bytes[k][c];
+                __m256i lo = _mm256_shuffle_epi8(
+                    _mm256_broadcastsi128_si256(
+                        _mm_loadu_si128((const __m128i*)&bytes[0])),
+                    digits);
+                __m256i hi = _mm256_shuffle_epi8(
+                    _mm256_broadcastsi128_si256(
+                        _mm_loadu_si128((const __m128i*)&bytes[16])),
+                    digits);
+                fg[c][0] =
+                    _mm256_add_epi16(fg[c][0], _mm256_unpacklo_epi8(lo, hi));
+                fg[c][1] =
+                    _mm256_add_epi16(fg[c][1], _mm256_unpackhi_epi8(lo, hi));
+            }
+        }
+
+        // Glyphs 8 at a time, in table order
+        for (int g = 0; g < 4 && i + g * 8 < table->count; g++) {
+            size_t base = i + g * 8;
+            __m256i n =
+                _mm256_loadu_si256((const __m256i*)&table->fg_count[base]);
+            __m256i bg_n =
+                _mm256_loadu_si256((const __m256i*)&table->bg_count[base]);
+            __m256i dist = sqr_sum;
+            for (int c = 0; c < 3; c++) {
+                __m256i sums = fg[c][g & 1];
+                __m128i half = g < 2 ? _mm256_castsi256_si128(sums)
+                                     : _mm256_extracti128_si256(sums, 1);
+                __m256i fg_sum = _mm256_cvtepu16_epi32(half);
+                __m256i bg_sum =
+                    _mm256_sub_epi32(_mm256_set1_epi32(totals[c]), fg_sum);
+                dist = _mm256_add_epi32(dist, wideGroupDistAVX2(fg_sum, n));
+                dist =
+                    _mm256_add_epi32(dist, wideGroupDistAVX2(bg_sum, bg_n));
+            }
+            uint32_t dists[8];
+            _mm256_storeu_si256((__m256i*)dists, dist);
+            size_t count = table->count - base < 8 ? table->count - base : 8;
+            updateMin(dists, base, count, &min_dist, &index);
+        }
+    }
+    getWideGlyphColors(table, index, pixels, colors);
+    return index;
+}
+
+#endif
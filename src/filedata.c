@@ -0,0 +1,87 @@
+#include "filedata.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define READ_MIN_CAP (1 << 16)
+
+// Read until the end into a buffer doubled as it fills up
+static int readAll(FileData* file, int fd) {
+    size_t cap = READ_MIN_CAP;
+    // One more byte to see the end without growing
+    if (file->st.st_size >= READ_MIN_CAP)
+        cap = (size_t)file->st.st_size + 1;
+    uint8_t* data = malloc(cap);
+    size_t len = 0;
+    while (data) {
+        ssize_t n = read(fd, data + len, cap - len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0) {
+            file->data = data;
+            file->len = len;
+            file->mapped = 0;
+            return 0;
+        }
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            uint8_t* grow = realloc(data, cap);
+            if (!grow)
+                free(data);
+            data = grow;
+        }
+    }
+    free(data);
+    return -1;
+}
+
+int loadFileDataFd(FileData* file, int fd) {
+    memset(file, 0, sizeof(*file));
+    if (fstat(fd, &file->st) != 0)
+        return -1;
+    // Only map whole files, stdin may have been read from already
+    if (!S_ISREG(file->st.st_mode) || file->st.st_size == 0 ||
+        lseek(fd, 0, SEEK_CUR) != 0)
+        return readAll(file, fd);
+
+    void* data = mmap(NULL, file->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return readAll(file, fd);
+    // Decoders read front to back, start reading ahead now
+    madvise(data, file->st.st_size, MADV_SEQUENTIAL);
+    madvise(data, file->st.st_size, MADV_WILLNEED);
+    file->data = data;
+    file->len = file->st.st_size;
+    file->mapped = 1;
+    return 0;
+}
+
+int loadFileData(FileData* file, const char* file_path) {
+    if (strcmp(file_path, "-") == 0)
+        return loadFileDataFd(file, STDIN_FILENO);
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    int ret = loadFileDataFd(file, fd);
+    // The mapping stays valid after the file is closed
+    close(fd);
+    return ret;
+}
+
+void freeFileData(FileData* file) {
+    if (file->mapped) {
+        munmap((void*)file->data, file->len);
+    } else {
+        free((void*)file->data);
+    }
+    file->data = NULL;
+    file->len = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef FILEDATA_H
+#define FILEDATA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Content of a whole file, mapped if it is a regular file and read into one
+// growable buffer otherwise
+typedef struct FileData {
+    const uint8_t* data;
+    size_t len;
+    int mapped;
+    struct stat st;
+} FileData;
+
+// Load the file, or stdin if file_path is "-"
+int loadFileData(FileData* file, const char* file_path);
+// Load from the file descriptor, which the caller still owns
+int loadFileDataFd(FileData* file, int fd);
+void freeFileData(FileData* file);
+
+#endif
@@ -0,0 +1,393 @@
+#include "font.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filedata.h"
+
+#define PSF1_MAGIC0 0x36
+#define PSF1_MAGIC1 0x04
+#define PSF1_MODE512 0x01
+#define PSF1_MODEHASTAB 0x02
+#define PSF1_MODESEQ 0x04
+#define PSF1_SEPARATOR 0xffff
+#define PSF1_STARTSEQ 0xfffe
+
+#define PSF2_MAGIC 0x864ab572
+#define PSF2_HEADER_SIZE 32
+#define PSF2_HAS_UNICODE_TABLE 0x01
+#define PSF2_SEPARATOR 0xff
+#define PSF2_STARTSEQ 0xfe
+
+// Largest font cell and most glyphs read from a file
+#define FONT_MAX_SIZE 256
+#define FONT_MAX_GLYPHS (1 << 20)
+#define BDF_LINE_MAX 1024
+
+// Returned by the loaders when memory runs out, -1 is a corrupt font
+#define FONT_NO_MEMORY -2
+
+static uint32_t readLE32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static size_t getGlyphBytes(const BitmapFont* font) {
+    return (size_t)(font->width + 7) / 8 * font->height;
+}
+
+static int addChar(BitmapFont* font, size_t* cap, uint32_t codepoint,
+                   uint32_t glyph) {
+    if (font->char_count == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 256;
+        FontChar* chars = realloc(font->chars, sizeof(FontChar) * new_cap);
+        if (!chars)
+            return FONT_NO_MEMORY;
+        font->chars = chars;
+        *cap = new_cap;
+    }
+    font->chars[font->char_count++] = (FontChar){codepoint, glyph};
+    return 0;
+}
+
+// Copy the bitmaps of count glyphs
+static int copyBitmaps(BitmapFont* font, const uint8_t* data, size_t count) {
+    font->bitmaps = malloc(getGlyphBytes(font) * count);
+    if (!font->bitmaps)
+        return FONT_NO_MEMORY;
+    memcpy(font->bitmaps, data, getGlyphBytes(font) * count);
+    font->glyph_count = count;
+    return 0;
+}
+
+// Length of the UTF-8 sequence at p, 0 if it is not valid
+static size_t decodeUtf8(const uint8_t* p, const uint8_t* end,
+                         uint32_t* codepoint) {
+    size_t len = *p < 0x80   ? 1
+                 : *p < 0xc0 ? 0
+                 : *p < 0xe0 ? 2
+                 : *p < 0xf0 ? 3
+                 : *p < 0xf8 ? 4
+                             : 0;
+    if (len == 0 || (size_t)(end - p) < len)
+        return 0;
+    uint32_t c = len == 1 ? *p : *p & (0x7f >> len);
+    for (size_t i = 1; i < len; i++) {
+        if ((p[i] & 0xc0) != 0x80)
+            return 0;
+        c = c << 6 | (p[i] & 0x3f);
+    }
+    *codepoint = c;
+    return len;
+}
+
+static int loadPsf1(BitmapFont* font, const uint8_t* data, size_t len,
+                    size_t* cap) {
+    int mode = data[2];
+    size_t count = mode & PSF1_MODE512 ? 512 : 256;
+    font->width = 8;
+    font->height = data[3];
+    if (font->height == 0 || len - 4 < count * font->height)
+        return -1;
+    if (copyBitmaps(font, data + 4, count) != 0)
+        return FONT_NO_MEMORY;
+
+    if (!(mode & (PSF1_MODEHASTAB | PSF1_MODESEQ))) {
+        for (size_t i = 0; i < count; i++) {
+            if (addChar(font, cap, i, i) != 0)
+                return FONT_NO_MEMORY;
+        }
+        return 0;
+    }
+    // Each glyph lists its codepoints, then sequences of them that are
+    // drawn with it, up to a separator
+    const uint8_t* p = data + 4 + count * font->height;
+    const uint8_t* end = data + len;
+    for (size_t i = 0; i < count && end - p >= 2; i++) {
+        int sequence = 0;
+        while (end - p >= 2) {
+            uint32_t c = p[0] | p[1] << 8;
+            p += 2;
+            if (c == PSF1_SEPARATOR)
+                break;
+            if (c == PSF1_STARTSEQ) {
+                sequence = 1;
+            } else if (!sequence && addChar(font, cap, c, i) != 0) {
+                return FONT_NO_MEMORY;
+            }
+        }
+    }
+    return 0;
+}
+
+static int loadPsf2(BitmapFont* font, const uint8_t* data, size_t len,
+                    size_t* cap) {
+    if (len < PSF2_HEADER_SIZE)
+        return -1;
+    uint32_t header_size = readLE32(data + 8);
+    uint32_t flags = readLE32(data + 12);
+    uint32_t count = readLE32(data + 16);
+    uint32_t glyph_bytes = readLE32(data + 20);
+    uint32_t height = readLE32(data + 24);
+    uint32_t width = readLE32(data + 28);
+    if (width == 0 || width > FONT_MAX_SIZE || height == 0 ||
+        height > FONT_MAX_SIZE || count == 0 || count > FONT_MAX_GLYPHS ||
+        glyph_bytes != (width + 7) / 8 * height ||
+        header_size < PSF2_HEADER_SIZE || header_size > len ||
+        (len - header_size) / glyph_bytes < count)
+        return -1;
+    font->width = width;
+    font->height = height;
+    if (copyBitmaps(font, data + header_size, count) != 0)
+        return FONT_NO_MEMORY;
+
+    if (!(flags & PSF2_HAS_UNICODE_TABLE)) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (addChar(font, cap, i, i) != 0)
+                return FONT_NO_MEMORY;
+        }
+        return 0;
+    }
+    const uint8_t* p = data + header_size + (size_t)count * glyph_bytes;
+    const uint8_t* end = data + len;
+    for (uint32_t i = 0; i < count && p < end; i++) {
+        int sequence = 0;
+        while (p < end) {
+            if (*p == PSF2_SEPARATOR) {
+                p++;
+                break;
+            }
+            if (*p == PSF2_STARTSEQ) {
+                sequence = 1;
+                p++;
+                continue;
+            }
+            uint32_t c;
+            size_t n = decodeUtf8(p, end, &c);
+            if (n == 0)
+                return -1;
+            p += n;
+            if (!sequence && addChar(font, cap, c, i) != 0)
+                return FONT_NO_MEMORY;
+        }
+    }
+    return 0;
+}
+
+static int isKeyword(const char* line, const char* keyword) {
+    size_t len = strlen(keyword);
+    return strncmp(line, keyword, len) == 0 &&
+           (line[len] == ' ' || line[len] == '\0');
+}
+
+static int getHexDigit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Draw row of the bitmap of a glyph with the bounding box into the font cell,
+// which is the font bounding box
+static void drawBdfRow(BitmapFont* font, uint8_t* glyph, const char* hex,
+                       int row, const int bbx[4], const int fbb[4]) {
+    // Rows of both boxes count up from the baseline
+    int y = fbb[1] + fbb[3] - 1 - (bbx[3] + bbx[1] - 1 - row);
+    if (y < 0 || y >= font->height)
+        return;
+    int row_bytes = (font->width + 7) / 8;
+    for (int i = 0; i < bbx[0]; i++) {
+        int digit = getHexDigit(hex[i / 4]);
+        if (digit < 0)
+            return;
+        int x = bbx[2] - fbb[2] + i;
+        if (((digit >> (3 - i % 4)) & 1) && x >= 0 && x < font->width)
+            glyph[y * row_bytes + x / 8] |= 0x80 >> (x % 8);
+    }
+}
+
+static int loadBdf(BitmapFont* font, const uint8_t* data, size_t len,
+                   size_t* cap) {
+    const char* p = (const char*)data;
+    const char* end = p + len;
+    // Width, height and offsets of the font and the glyph
+    int fbb[4] = {0};
+    int bbx[4] = {0};
+    long encoding = -1;
+    // Row of the bitmap being read, or -1 outside of one
+    int row = -1;
+    size_t glyph_cap = 0;
+    uint8_t* glyph = NULL;
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        char line[BDF_LINE_MAX];
+        size_t line_len = eol - p;
+        if (line_len >= sizeof(line))
+            return -1;
+        memcpy(line, p, line_len);
+        line[line_len] = '\0';
+        if (line_len > 0 && line[line_len - 1] == '\r')
+            line[line_len - 1] = '\0';
+        p = eol + 1;
+
+        if (isKeyword(line, "FONTBOUNDINGBOX")) {
+            // The bitmaps already read are of the first size
+            if (sscanf(line + 15, "%d %d %d %d", &fbb[0], &fbb[1], &fbb[2],
+                       &fbb[3]) != 4 ||
+                fbb[0] < 1 || fbb[0] > FONT_MAX_SIZE || fbb[1] < 1 ||
+                fbb[1] > FONT_MAX_SIZE || glyph_cap > 0)
+                return -1;
+            font->width = fbb[0];
+            font->height = fbb[1];
+        } else if (isKeyword(line, "STARTCHAR")) {
+            encoding = -1;
+            memset(bbx, 0, sizeof(bbx));
+        } else if (isKeyword(line, "ENCODING")) {
+            // Glyphs without a standard encoding are -1
+            if (sscanf(line + 8, "%ld", &encoding) != 1)
+                return -1;
+        } else if (isKeyword(line, "BBX")) {
+            if (sscanf(line + 3, "%d %d %d %d", &bbx[0], &bbx[1], &bbx[2],
+                       &bbx[3]) != 4 ||
+                bbx[0] < 0 || bbx[0] > FONT_MAX_SIZE || bbx[1] < 0 ||
+                bbx[1] > FONT_MAX_SIZE)
+                return -1;
+        } else if (isKeyword(line, "BITMAP")) {
+            if (!font->width || font->glyph_count == FONT_MAX_GLYPHS)
+                return -1;
+            size_t glyph_bytes = getGlyphBytes(font);
+            if (font->glyph_count == glyph_cap) {
+                size_t new_cap = glyph_cap ? glyph_cap * 2 : 256;
+                uint8_t* bitmaps =
+                    realloc(font->bitmaps, glyph_bytes * new_cap);
+                if (!bitmaps)
+                    return FONT_NO_MEMORY;
+                font->bitmaps = bitmaps;
+                glyph_cap = new_cap;
+            }
+            glyph = font->bitmaps + glyph_bytes * font->glyph_count;
+            memset(glyph, 0, glyph_bytes);
+            row = 0;
+        } else if (isKeyword(line, "ENDCHAR")) {
+            if (row >= 0 && encoding >= 0 && encoding <= 0x10ffff) {
+                if (addChar(font, cap, encoding, font->glyph_count) != 0)
+                    return FONT_NO_MEMORY;
+                font->glyph_count++;
+            }
+            row = -1;
+        } else if (row >= 0 && row < bbx[1]) {
+            if (strlen(line) < (size_t)(bbx[0] + 3) / 4)
+                return -1;
+            drawBdfRow(font, glyph, line, row++, bbx, fbb);
+        }
+    }
+    return font->glyph_count > 0 ? 0 : -1;
+}
+
+static int compareChars(const void* a, const void* b) {
+    const FontChar* x = a;
+    const FontChar* y = b;
+    if (x->codepoint != y->codepoint)
+        return x->codepoint < y->codepoint ? -1 : 1;
+    return x->glyph < y->glyph ? -1 : x->glyph > y->glyph;
+}
+
+int loadBitmapFont(BitmapFont* font, const char* file_path) {
+    memset(font, 0, sizeof(*font));
+    FileData file;
+    if (loadFileData(&file, file_path) != 0) {
+        fprintf(stderr, "Cannot open font %s\n", file_path);
+        return -1;
+    }
+
+    const uint8_t* data = file.data;
+    size_t cap = 0;
+    int ret;
+    if (file.len >= 4 && data[0] == PSF1_MAGIC0 && data[1] == PSF1_MAGIC1) {
+        ret = loadPsf1(font, data, file.len, &cap);
+    } else if (file.len >= 4 && readLE32(data) == PSF2_MAGIC) {
+        ret = loadPsf2(font, data, file.len, &cap);
+    } else if (file.len >= 9 && memcmp(data, "STARTFONT", 9) == 0) {
+        ret = loadBdf(font, data, file.len, &cap);
+    } else {
+        fprintf(stderr, "Font %s is not a BDF or PSF font\n", file_path);
+        freeFileData(&file);
+        return -1;
+    }
+    freeFileData(&file);
+    if (ret == FONT_NO_MEMORY) {
+        fprintf(stderr, "Cannot allocate memory for font %s\n", file_path);
+        freeBitmapFont(font);
+        return -1;
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Font %s is corrupt\n", file_path);
+        freeBitmapFont(font);
+        return -1;
+    }
+    qsort(font->chars, font->char_count, sizeof(FontChar), compareChars);
+    return 0;
+}
+
+void freeBitmapFont(BitmapFont* font) {
+    free(font->bitmaps);
+    free(font->chars);
+    memset(font, 0, sizeof(*font));
+}
+
+static int getFontPixel(const BitmapFont* font, const uint8_t* glyph, int x,
+                        int y) {
+    int row_bytes = (font->width + 7) / 8;
+    return (glyph[y * row_bytes + x / 8] >> (7 - x % 8)) & 1;
+}
+
+int getFontMask(const BitmapFont* font, uint32_t codepoint, int cell_w,
+                int cell_h, uint32_t* mask) {
+    // First glyph of the codepoint
+    size_t lo = 0, hi = font->char_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (font->chars[mid].codepoint < codepoint) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == font->char_count || font->chars[lo].codepoint != codepoint)
+        return -1;
+    const uint8_t* glyph =
+        font->bitmaps + getGlyphBytes(font) * font->chars[lo].glyph;
+
+    // A cell pixel spans font_h x font_w units, a font pixel cell_h x cell_w
+    int font_w = font->width, font_h = font->height;
+    memset(mask, 0, sizeof(uint32_t) * ((cell_w * cell_h + 31) / 32));
+    for (int y = 0; y < cell_h; y++) {
+        long y0 = (long)y * font_h, y1 = y0 + font_h;
+        for (int x = 0; x < cell_w; x++) {
+            long x0 = (long)x * font_w, x1 = x0 + font_w;
+            long covered = 0;
+            for (long fy = y0 / cell_h; fy * cell_h < y1; fy++) {
+                long top = fy * cell_h > y0 ? fy * cell_h : y0;
+                long bottom = (fy + 1) * cell_h < y1 ? (fy + 1) * cell_h : y1;
+                for (long fx = x0 / cell_w; fx * cell_w < x1; fx++) {
+                    if (!getFontPixel(font, glyph, fx, fy))
+                        continue;
+                    long left = fx * cell_w > x0 ? fx * cell_w : x0;
+                    long right =
+                        (fx + 1) * cell_w < x1 ? (fx + 1) * cell_w : x1;
+                    covered += (bottom - top) * (right - left);
+                }
+            }
+            if (2 * covered >= (long)font_h * font_w) {
+                int p = y * cell_w + x;
+                mask[p / 32] |= 1u << (31 - p % 32);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Glyph drawn for a codepoint
+typedef struct FontChar {
+    uint32_t codepoint;
+    uint32_t glyph;
+} FontChar;
+
+// Bitmap font read from a BDF or PSF file, every glyph drawn in a cell of the
+// font size
+typedef struct BitmapFont {
+    int width;
+    int height;
+    // Rows of (width + 7) / 8 bytes per glyph, the highest bit of a byte is
+    // the leftmost pixel
+    uint8_t* bitmaps;
+    size_t glyph_count;
+    // Sorted by codepoint, then glyph
+    FontChar* chars;
+    size_t char_count;
+} BitmapFont;
+
+// Print the reason to stderr and return -1 if it cannot be read
+int loadBitmapFont(BitmapFont* font, const char* file_path);
+void freeBitmapFont(BitmapFont* font);
+
+// Scale the glyph of the codepoint to cell_w x cell_h pixels and store it as
+// a mask of (cell_w * cell_h + 31) / 32 words, in rows from the top left with
+// the first pixel the highest bit. A pixel is set if at least half of the font
+// pixels under it are. Return -1 if the font has no glyph for the codepoint.
+int getFontMask(const BitmapFont* font, uint32_t codepoint, int cell_w,
+                int cell_h, uint32_t* mask);
+
+#endif
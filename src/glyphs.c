@@ -0,0 +1,637 @@
+#include "glyphs.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+
+// "igs1" at the start of a compiled set
+#define GLYPHS_MAGIC 0x31736769
+// Change when the layout of a compiled set changes
+#define GLYPHS_VERSION 2
+// Longest line of a text definition
+#define GLYPHS_LINE_MAX 256
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// A glyph covers the pixels of the mask, the top left pixel is the highest
+// bit of the first word. Its UTF-8 bytes are packed at compile time so
+// printing is one store.
+typedef struct Glyph {
+    uint32_t mask[MATCH_MAX_WORDS];
+    uint32_t utf8;
+} Glyph;
+
+#define GLYPH(mask, codepoint) {{mask}, UTF8_PACK(codepoint)}
+
+static const Glyph default_glyphs[] = {
+    GLYPH(0x00000000, 0x00a0),
+
+    // Block graphics
+    // GLYPH(0xffff0000, 0x2580),  // upper 1/2; inverse of lower 1/2
+
+    GLYPH(0x0000000f, 0x2581),  // lower 1/8
+    GLYPH(0x000000ff, 0x2582),  // lower 1/4
+    GLYPH(0x00000fff, 0x2583),  //
+    GLYPH(0x0000ffff, 0x2584),  // lower 1/2
+    GLYPH(0x000fffff, 0x2585),  //
+    GLYPH(0x00ffffff, 0x2586),  // lower 3/4
+    GLYPH(0x0fffffff, 0x2587),  //
+    // GLYPH(0xffffffff, 0x2588),  // full; redundant with inverse space
+
+    GLYPH(0xeeeeeeee, 0x258a),  // left 3/4
+    GLYPH(0xcccccccc, 0x258c),  // left 1/2
+    GLYPH(0x88888888, 0x258e),  // left 1/4
+
+    GLYPH(0x0000cccc, 0x2596),  // quadrant lower left
+    GLYPH(0x00003333, 0x2597),  // quadrant lower right
+    GLYPH(0xcccc0000, 0x2598),  // quadrant upper left
+    // GLYPH(0xccccffff, 0x2599),  // 3/4 redundant with inverse 1/4
+    GLYPH(0xcccc3333, 0x259a),  // diagonal 1/2
+                         // GLYPH(0xffffcccc, 0x259b),  // 3/4 redundant
+    // GLYPH(0xffff3333, 0x259c),  // 3/4 redundant
+    GLYPH(0x33330000, 0x259d),  // quadrant upper right
+                         // GLYPH(0x3333cccc, 0x259e),  // 3/4 redundant
+    // GLYPH(0x3333ffff, 0x259f),  // 3/4 redundant
+
+    // Line drawing subset: no double lines, no complex light lines
+
+    GLYPH(0x000ff000, 0x2501),  // Heavy horizontal
+    GLYPH(0x66666666, 0x2503),  // Heavy vertical
+
+    GLYPH(0x00077666, 0x250f),  // Heavy down and right
+    GLYPH(0x000ee666, 0x2513),  // Heavy down and left
+    GLYPH(0x66677000, 0x2517),  // Heavy up and right
+    GLYPH(0x666ee000, 0x251b),  // Heavy up and left
+
+    GLYPH(0x66677666, 0x2523),  // Heavy vertical and right
+    GLYPH(0x666ee666, 0x252b),  // Heavy vertical and left
+    GLYPH(0x000ff666, 0x2533),  // Heavy down and horizontal
+    GLYPH(0x666ff000, 0x253b),  // Heavy up and horizontal
+    GLYPH(0x666ff666, 0x254b),  // Heavy cross
+
+    GLYPH(0x000cc000, 0x2578),  // Bold horizontal left
+    GLYPH(0x00066000, 0x2579),  // Bold horizontal up
+    GLYPH(0x00033000, 0x257a),  // Bold horizontal right
+    GLYPH(0x00066000, 0x257b),  // Bold horizontal down
+
+    GLYPH(0x06600660, 0x254f),  // Heavy double dash vertical
+
+    GLYPH(0x000f0000, 0x2500),  // Light horizontal
+    GLYPH(0x0000f000, 0x2500),  //
+    GLYPH(0x44444444, 0x2502),  // Light vertical
+    GLYPH(0x22222222, 0x2502),  //
+
+    GLYPH(0x000e0000, 0x2574),  // light left
+    GLYPH(0x0000e000, 0x2574),  // light left
+    GLYPH(0x44440000, 0x2575),  // light up
+    GLYPH(0x22220000, 0x2575),  // light up
+    GLYPH(0x00030000, 0x2576),  // light right
+    GLYPH(0x00003000, 0x2576),  // light right
+    GLYPH(0x00004444, 0x2577),  // light down
+    GLYPH(0x00002222, 0x2577),  // light down
+
+    // Misc technical
+
+    GLYPH(0x44444444, 0x23a2),  // [ extension
+    GLYPH(0x22222222, 0x23a5),  // ] extension
+
+    GLYPH(0x0f000000, 0x23ba),  // Horizontal scanline 1
+    GLYPH(0x00f00000, 0x23bb),  // Horizontal scanline 3
+    GLYPH(0x00000f00, 0x23bc),  // Horizontal scanline 7
+    GLYPH(0x000000f0, 0x23bd),  // Horizontal scanline 9
+
+    // Geometrical shapes. Tricky because some of them are too wide.
+
+    // GLYPH(0x00ffff00, 0x25fe),  // Black medium small square
+    GLYPH(0x00066000, 0x25aa),  // Black small square
+};
+
+// Start of a compiled set. It is followed by the arrays of the match table,
+// masks of words * stride entries, fg_count, bg_count, fg_recip, bg_recip and
+// utf8 of stride entries each, then the bytes of nibbles. Everything is in the
+// byte order of the machine that compiled it.
+typedef struct GlyphHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recip_shift;
+    uint32_t cell_w;
+    uint32_t cell_h;
+    uint32_t count;
+    uint32_t stride;
+    uint32_t half_block;
+} GlyphHeader;
+
+// Arrays of stride entries besides the masks
+#define GLYPH_ARRAYS 5
+#define GLYPH_IMAGE_SIZE(stride, words)                       \
+    (sizeof(GlyphHeader) +                                    \
+     sizeof(uint32_t) * (stride) * ((words) + GLYPH_ARRAYS) + \
+     (size_t)(words) * 8 * (stride))
+
+#define DEFAULT_COUNT (sizeof(default_glyphs) / sizeof(Glyph))
+#define DEFAULT_STRIDE \
+    ((DEFAULT_COUNT + MATCH_BATCH - 1) / MATCH_BATCH * MATCH_BATCH)
+
+// Reads a text definition line by line, without comments
+typedef struct LineReader {
+    const char* file_path;
+    const char* p;
+    const char* end;
+    int line;
+    char buf[GLYPHS_LINE_MAX];
+} LineReader;
+
+static GlyphSet default_set;
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+// Compiled default set, static so building it cannot run out of memory
+static _Alignas(uint64_t) uint8_t
+    default_image[GLYPH_IMAGE_SIZE(DEFAULT_STRIDE, 1)];
+
+static size_t getStride(size_t count, int words) {
+    size_t batch = words > 1 ? MATCH_WIDE_BATCH : MATCH_BATCH;
+    return (count + batch - 1) / batch * batch;
+}
+
+static size_t getImageSize(size_t stride, int words) {
+    return GLYPH_IMAGE_SIZE(stride, words);
+}
+
+static uint32_t getRecip(int count) {
+    // An empty group has a zero sum, any reciprocal works
+    if (!count)
+        return 0;
+    return ((1u << MATCH_RECIP_SHIFT) + count - 1) / count;
+}
+
+int parseCellSize(const char* s, int* cell_w, int* cell_h) {
+    char* end;
+    long w = strtol(s, &end, 10);
+    if (end == s || *end != 'x')
+        return -1;
+    s = end + 1;
+    long h = strtol(s, &end, 10);
+    if (end == s || *end != '\0')
+        return -1;
+    // Whole words of at most MATCH_MAX_PIXELS
+    if (w < 1 || h < 1 || w * h > MATCH_MAX_PIXELS || w * h % 32 != 0)
+        return -1;
+    *cell_w = w;
+    *cell_h = h;
+    return 0;
+}
+
+// Pixels in the lower half of the cell
+static void getHalfMask(int cell_w, int cell_h, uint32_t* mask) {
+    int pixels = cell_w * cell_h;
+    memset(mask, 0, sizeof(uint32_t) * (pixels / 32));
+    for (int p = cell_w * (cell_h / 2); p < pixels; p++) {
+        mask[p / 32] |= 1u << (31 - p % 32);
+    }
+}
+
+static int getFgCount(const uint32_t* mask, int words) {
+    int count = 0;
+    for (int w = 0; w < words; w++) {
+        count += __builtin_popcount(mask[w]);
+    }
+    return count;
+}
+
+// 1 if the masks are equal, -1 if one is the complement of the other
+static int compareMasks(const uint32_t* a, const uint32_t* b, int words) {
+    int equal = 1, inverse = 1;
+    for (int w = 0; w < words; w++) {
+        equal &= a[w] == b[w];
+        inverse &= a[w] == ~b[w];
+    }
+    return equal ? 1 : inverse ? -1 : 0;
+}
+
+// A glyph is redundant if the set already has its mask, or the complement
+// of its mask, which only swaps the bg and fg colors. Ties go to the glyph
+// earlier in the table, so a redundant one would never be picked.
+static int isRedundantMask(const Glyph* glyphs, size_t count,
+                           const uint32_t* mask, int words) {
+    for (size_t i = 0; i < count; i++) {
+        if (compareMasks(glyphs[i].mask, mask, words) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Drop the redundant glyphs in place, return how many are left
+static size_t dropRedundantGlyphs(Glyph* glyphs, size_t count, int words) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!isRedundantMask(glyphs, n, glyphs[i].mask, words))
+            glyphs[n++] = glyphs[i];
+    }
+    return n;
+}
+
+// Lay out the glyphs for the matchers into data, zeroed and of getImageSize
+// bytes
+static void writeGlyphImage(uint8_t* data, const Glyph* glyphs, size_t n,
+                            int cell_w, int cell_h) {
+    int words = cell_w * cell_h / 32;
+    size_t stride = getStride(n, words);
+    GlyphHeader header = {.magic = GLYPHS_MAGIC,
+                          .version = GLYPHS_VERSION,
+                          .recip_shift = MATCH_RECIP_SHIFT,
+                          .cell_w = cell_w,
+                          .cell_h = cell_h,
+                          .count = n,
+                          .stride = stride};
+    uint32_t* masks = (uint32_t*)(data + sizeof(GlyphHeader));
+    int32_t* fg_count = (int32_t*)(masks + words * stride);
+    int32_t* bg_count = fg_count + stride;
+    uint32_t* fg_recip = (uint32_t*)(bg_count + stride);
+    uint32_t* bg_recip = fg_recip + stride;
+    uint32_t* utf8 = bg_recip + stride;
+    uint8_t* nibbles = (uint8_t*)(utf8 + stride);
+    uint32_t half[MATCH_MAX_WORDS];
+    getHalfMask(cell_w, cell_h, half);
+    // Entries past the glyphs are empty masks
+    for (size_t i = 0; i < n; i++) {
+        for (int w = 0; w < words; w++) {
+            masks[w * stride + i] = glyphs[i].mask[w];
+            for (int k = 0; k < 8; k++) {
+                nibbles[(w * 8 + k) * stride + i] =
+                    (glyphs[i].mask[w] >> (28 - k * 4)) & 0xf;
+            }
+        }
+        utf8[i] = glyphs[i].utf8;
+        if (compareMasks(glyphs[i].mask, half, words) != 0)
+            header.half_block = i;
+    }
+    for (size_t i = 0; i < stride; i++) {
+        int fg = i < n ? getFgCount(glyphs[i].mask, words) : 0;
+        fg_count[i] = fg;
+        bg_count[i] = words * 32 - fg;
+        fg_recip[i] = getRecip(fg_count[i]);
+        bg_recip[i] = getRecip(bg_count[i]);
+    }
+    memcpy(data, &header, sizeof(header));
+}
+
+// Point the set into its compiled image, checking everything the matchers
+// rely on
+static int openGlyphImage(GlyphSet* set) {
+    const uint8_t* data = set->file.data;
+    size_t len = set->file.len;
+    GlyphHeader header;
+    if (len < sizeof(header))
+        return -1;
+    memcpy(&header, data, sizeof(header));
+    // Each side is bounded first so that the product cannot wrap
+    if (header.magic != GLYPHS_MAGIC || header.version != GLYPHS_VERSION ||
+        header.recip_shift != MATCH_RECIP_SHIFT || header.cell_w < 1 ||
+        header.cell_h < 1 || header.cell_w > MATCH_MAX_PIXELS ||
+        header.cell_h > MATCH_MAX_PIXELS ||
+        header.cell_w * header.cell_h > MATCH_MAX_PIXELS ||
+        header.cell_w * header.cell_h % 32 != 0 || header.count == 0)
+        return -1;
+    int words = header.cell_w * header.cell_h / 32;
+    size_t stride = header.stride;
+    if (words == 0 || stride != getStride(header.count, words) ||
+        header.half_block >= header.count ||
+        len != getImageSize(stride, words))
+        return -1;
+
+    MatchTable* table = &set->table;
+    const uint32_t* masks = (const uint32_t*)(data + sizeof(header));
+    table->count = header.count;
+    table->stride = stride;
+    table->words = words;
+    table->masks = masks;
+    table->fg_count = (const int32_t*)(masks + words * stride);
+    table->bg_count = table->fg_count + stride;
+    table->fg_recip = (const uint32_t*)(table->bg_count + stride);
+    table->bg_recip = table->fg_recip + stride;
+    set->utf8 = table->bg_recip + stride;
+    table->nibbles = (const uint8_t*)(set->utf8 + stride);
+    set->cell_w = header.cell_w;
+    set->cell_h = header.cell_h;
+    set->half_block = header.half_block;
+    for (size_t i = 0; i < stride; i++) {
+        int fg_count = 0;
+        for (int w = 0; w < words; w++) {
+            uint32_t mask = masks[w * stride + i];
+            if (i >= table->count && mask != 0)
+                return -1;
+            fg_count += __builtin_popcount(mask);
+            for (int k = 0; k < 8; k++) {
+                if (table->nibbles[(w * 8 + k) * stride + i] !=
+                    ((mask >> (28 - k * 4)) & 0xf))
+                    return -1;
+            }
+        }
+        int bg_count = words * 32 - fg_count;
+        if (table->fg_count[i] != fg_count ||
+            table->bg_count[i] != bg_count ||
+            table->fg_recip[i] != getRecip(fg_count) ||
+            table->bg_recip[i] != getRecip(bg_count) ||
+            (i < table->count) != (set->utf8[i] != 0))
+            return -1;
+    }
+
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    set->id = hash;
+    return 0;
+}
+
+// Split off the next word of the line, NULL at the end
+static char* nextWord(char** p) {
+    char* s = *p + strspn(*p, " \t\r");
+    if (*s == '\0')
+        return NULL;
+    char* end = s + strcspn(s, " \t\r");
+    *p = *end ? end + 1 : end;
+    *end = '\0';
+    return s;
+}
+
+// Split the next line that is not empty into its first two words and the
+// rest of it. Return 0 at the end, or -1 if the line is too long or has a
+// single word.
+static int readGlyphLine(LineReader* reader, char* words[3]) {
+    while (reader->p < reader->end) {
+        const char* eol = memchr(reader->p, '\n', reader->end - reader->p);
+        if (!eol)
+            eol = reader->end;
+        size_t len = eol - reader->p;
+        reader->line++;
+        if (len >= sizeof(reader->buf)) {
+            fprintf(stderr, "Glyph set %s line %d is too long\n",
+                    reader->file_path, reader->line);
+            return -1;
+        }
+        memcpy(reader->buf, reader->p, len);
+        reader->buf[len] = '\0';
+        reader->p = eol + 1;
+
+        char* comment = strchr(reader->buf, '#');
+        if (comment)
+            *comment = '\0';
+        char* p = reader->buf;
+        words[0] = nextWord(&p);
+        if (!words[0])
+            continue;
+        words[1] = nextWord(&p);
+        if (!words[1]) {
+            fprintf(stderr, "Glyph set %s line %d has a single field\n",
+                    reader->file_path, reader->line);
+            return -1;
+        }
+        // The name, without the spaces around it
+        p += strspn(p, " \t\r");
+        len = strlen(p);
+        while (len > 0 && strchr(" \t\r", p[len - 1])) {
+            p[--len] = '\0';
+        }
+        words[2] = p;
+        return 1;
+    }
+    return 0;
+}
+
+// Hex digits of the words of the mask, after an optional 0x
+static int parseMask(const char* s, int words, uint32_t* mask) {
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+        s += 2;
+    size_t digits = words * 8;
+    if (strspn(s, "0123456789abcdefABCDEF") != digits || s[digits] != '\0')
+        return -1;
+    for (int w = 0; w < words; w++) {
+        char word[9];
+        memcpy(word, s + w * 8, 8);
+        word[8] = '\0';
+        mask[w] = strtoul(word, NULL, 16);
+    }
+    return 0;
+}
+
+// U+XXXX or hex, of a printable character
+static int parseCodepoint(const char* s, uint32_t* codepoint) {
+    if ((s[0] == 'U' || s[0] == 'u') && s[1] == '+') {
+        s += 2;
+    } else if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        s += 2;
+    }
+    size_t digits = strspn(s, "0123456789abcdefABCDEF");
+    if (digits == 0 || digits > 6 || s[digits] != '\0')
+        return -1;
+    uint32_t c = strtoul(s, NULL, 16);
+    // Control characters, surrogates and past the last codepoint
+    if (c < 0x20 || (c >= 0x7f && c < 0xa0) || (c >= 0xd800 && c < 0xe000) ||
+        c > 0x10ffff)
+        return -1;
+    *codepoint = c;
+    return 0;
+}
+
+// Parse the text definition into a growable glyph array. The cell size is
+// 4x8 unless a "cell WxH" line comes before the glyphs.
+static int parseGlyphs(const char* file_path, const FileData* file,
+                       Glyph** glyphs, size_t* count, int* cell_w,
+                       int* cell_h) {
+    LineReader reader = {.file_path = file_path,
+                         .p = (const char*)file->data,
+                         .end = (const char*)file->data + file->len};
+    *cell_w = 4;
+    *cell_h = 8;
+    size_t cap = 64;
+    size_t n = 0;
+    Glyph* list = malloc(sizeof(Glyph) * cap);
+    char* words[3];
+    int ret = 0;
+    while (list && (ret = readGlyphLine(&reader, words)) > 0) {
+        if (strcmp(words[0], "cell") == 0) {
+            if (n > 0 || parseCellSize(words[1], cell_w, cell_h) != 0) {
+                fprintf(stderr,
+                        "Glyph set %s line %d should be a cell size before "
+                        "the glyphs, with whole 32-pixel words of at most "
+                        "%d pixels\n",
+                        file_path, reader.line, MATCH_MAX_PIXELS);
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+
+        Glyph glyph = {{0}, 0};
+        int mask_words = *cell_w * *cell_h / 32;
+        uint32_t codepoint;
+        if (parseMask(words[0], mask_words, glyph.mask) != 0 ||
+            parseCodepoint(words[1], &codepoint) != 0) {
+            fprintf(stderr,
+                    "Glyph set %s line %d should be a mask of %d hex digits "
+                    "and a codepoint\n",
+                    file_path, reader.line, mask_words * 8);
+            ret = -1;
+            break;
+        }
+        glyph.utf8 = UTF8_PACK(codepoint);
+        if (n == cap) {
+            Glyph* grow = realloc(list, sizeof(Glyph) * (cap *= 2));
+            if (!grow)
+                free(list);
+            list = grow;
+        }
+        if (list)
+            list[n++] = glyph;
+    }
+    if (!list) {
+        fprintf(stderr, "Cannot allocate memory for glyph set %s\n",
+                file_path);
+        return -1;
+    }
+    if (ret < 0) {
+        free(list);
+        return -1;
+    }
+    *glyphs = list;
+    *count = n;
+    return 0;
+}
+
+// Compile the glyphs, dropping the redundant ones in place, and point the set
+// into the result. Return -1 if there is no memory for it.
+static int buildGlyphSet(GlyphSet* set, Glyph* glyphs, size_t count,
+                         int cell_w, int cell_h) {
+    int words = cell_w * cell_h / 32;
+    size_t n = dropRedundantGlyphs(glyphs, count, words);
+    size_t len = getImageSize(getStride(n, words), words);
+    uint8_t* data = calloc(1, len);
+    if (!data)
+        return -1;
+    writeGlyphImage(data, glyphs, n, cell_w, cell_h);
+    memset(&set->file, 0, sizeof(set->file));
+    set->file.data = data;
+    set->file.len = len;
+    openGlyphImage(set);
+    return 0;
+}
+
+static void buildDefaultGlyphSet(void) {
+    Glyph glyphs[DEFAULT_COUNT];
+    memcpy(glyphs, default_glyphs, sizeof(glyphs));
+    size_t n = dropRedundantGlyphs(glyphs, DEFAULT_COUNT, 1);
+    writeGlyphImage(default_image, glyphs, n, 4, 8);
+    default_set.file.data = default_image;
+    default_set.file.len = getImageSize(getStride(n, 1), 1);
+    openGlyphImage(&default_set);
+}
+
+const GlyphSet* getDefaultGlyphSet(void) {
+    pthread_once(&default_once, buildDefaultGlyphSet);
+    return &default_set;
+}
+
+int loadGlyphSet(GlyphSet* set, const char* file_path) {
+    memset(set, 0, sizeof(*set));
+    if (loadFileData(&set->file, file_path) != 0) {
+        fprintf(stderr, "Cannot open glyph set %s\n", file_path);
+        return -1;
+    }
+
+    uint32_t magic = 0;
+    if (set->file.len >= sizeof(magic))
+        memcpy(&magic, set->file.data, sizeof(magic));
+    if (magic == GLYPHS_MAGIC) {
+        // Used in place, mapped if it is a regular file
+        if (openGlyphImage(set) == 0)
+            return 0;
+        fprintf(stderr, "Glyph set %s is corrupt or from another version\n",
+                file_path);
+        freeGlyphSet(set);
+        return -1;
+    }
+    if (magic == __builtin_bswap32(GLYPHS_MAGIC)) {
+        fprintf(stderr, "Glyph set %s was compiled with another byte order\n",
+                file_path);
+        freeGlyphSet(set);
+        return -1;
+    }
+
+    Glyph* glyphs;
+    size_t count;
+    int cell_w, cell_h;
+    int ret =
+        parseGlyphs(file_path, &set->file, &glyphs, &count, &cell_w, &cell_h);
+    freeGlyphSet(set);
+    if (ret != 0)
+        return -1;
+    if (count == 0) {
+        fprintf(stderr, "Glyph set %s has no glyphs\n", file_path);
+        free(glyphs);
+        return -1;
+    }
+    ret = buildGlyphSet(set, glyphs, count, cell_w, cell_h);
+    free(glyphs);
+    if (ret != 0) {
+        fprintf(stderr, "Cannot allocate memory for glyph set %s\n",
+                file_path);
+        return -1;
+    }
+    return 0;
+}
+
+void freeGlyphSet(GlyphSet* set) {
+    freeFileData(&set->file);
+    memset(set, 0, sizeof(*set));
+}
+
+int rasterizeGlyphSet(OutBuf* out, const char* file_path,
+                      const BitmapFont* font, int cell_w, int cell_h) {
+    FileData file;
+    if (loadFileData(&file, file_path) != 0) {
+        fprintf(stderr, "Cannot open glyph set %s\n", file_path);
+        return -1;
+    }
+    LineReader reader = {.file_path = file_path,
+                         .p = (const char*)file.data,
+                         .end = (const char*)file.data + file.len};
+    int words = cell_w * cell_h / 32;
+    char line[GLYPHS_LINE_MAX + MATCH_MAX_WORDS * 8 + 16];
+    snprintf(line, sizeof(line), "cell %dx%d\n", cell_w, cell_h);
+    outPuts(out, line);
+
+    char* fields[3];
+    int ret;
+    while ((ret = readGlyphLine(&reader, fields)) > 0) {
+        uint32_t codepoint;
+        // The masks and cell size of the definition are replaced
+        if (strcmp(fields[0], "cell") == 0)
+            continue;
+        if (parseCodepoint(fields[1], &codepoint) != 0) {
+            fprintf(stderr, "Glyph set %s line %d should have a codepoint\n",
+                    file_path, reader.line);
+            ret = -1;
+            break;
+        }
+        uint32_t mask[MATCH_MAX_WORDS];
+        if (getFontMask(font, codepoint, cell_w, cell_h, mask) != 0) {
+            fprintf(stderr, "Font has no glyph for U+%04X, left out\n",
+                    (unsigned)codepoint);
+            continue;
+        }
+        int len = 0;
+        for (int w = 0; w < words; w++) {
+            len += snprintf(line + len, sizeof(line) - len, "%08x",
+                            (unsigned)mask[w]);
+        }
+        snprintf(line + len, sizeof(line) - len, " U+%04X%s%s\n",
+                 (unsigned)codepoint, *fields[2] ? " " : "", fields[2]);
+        outPuts(out, line);
+    }
+    freeFileData(&file);
+    return ret < 0 ? -1 : 0;
+}
@@ -0,0 +1,53 @@
+#ifndef GLYPHS_H
+#define GLYPHS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "filedata.h"
+#include "font.h"
+#include "match.h"
+#include "output.h"
+
+// Glyphs to match cells against, with the arrays of the table and the UTF-8
+// bytes pointing into one compiled image. A compiled file is mapped and used
+// as it is.
+typedef struct GlyphSet {
+    MatchTable table;
+    // Pixels per cell the masks cover
+    int cell_w;
+    int cell_h;
+    // UTF-8 bytes of each glyph, packed as by UTF8_PACK
+    const uint32_t* utf8;
+    // Index of the lower or upper half block, the hint for the first cell of
+    // a row
+    size_t half_block;
+    // Hash of the compiled image, to key cached output
+    uint64_t id;
+    FileData file;
+} GlyphSet;
+
+// Glyphs built into imgterm, built on the first call
+const GlyphSet* getDefaultGlyphSet(void);
+
+// Load a compiled glyph set, or compile a text definition with one glyph per
+// line:
+//     <mask> <codepoint> [name]
+// The mask covers the pixels of a cell in rows from the top left, 4 to a hex
+// digit with the highest bit the leftmost pixel. Cells are 4x8 unless a
+// "cell WxH" line comes first. The codepoint is U+XXXX or hex. Text after # is
+// a comment. Glyphs whose mask or its complement is already in the set are
+// dropped. Print the reason to stderr and return -1 if it cannot be used.
+int loadGlyphSet(GlyphSet* set, const char* file_path);
+void freeGlyphSet(GlyphSet* set);
+
+// WxH of whole 32-pixel words, up to MATCH_MAX_PIXELS
+int parseCellSize(const char* s, int* cell_w, int* cell_h);
+
+// Write the text definition of file_path again with masks drawn from the font
+// at the cell size. Codepoints the font does not have are reported and left
+// out.
+int rasterizeGlyphSet(OutBuf* out, const char* file_path,
+                      const BitmapFont* font, int cell_w, int cell_h);
+
+#endif
@@ -0,0 +1,123 @@
+#include "grid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int initCellGrid(CellGrid* grid, int cols, int rows, int width) {
+    size_t count = (size_t)cols * rows;
+    grid->cols = cols;
+    grid->rows = rows;
+    grid->width = width;
+    // The three arrays share one allocation
+    grid->glyphs = calloc(count * 3, sizeof(uint32_t));
+    if (!grid->glyphs && count)
+        return -1;
+    grid->bg = grid->glyphs + count;
+    grid->fg = grid->bg + count;
+    return 0;
+}
+
+void freeCellGrid(CellGrid* grid) {
+    free(grid->glyphs);
+    grid->glyphs = grid->bg = grid->fg = NULL;
+}
+
+void getGridRows(const CellGrid* grid, int row, int count, CellGrid* rows) {
+    size_t start = (size_t)row * grid->cols;
+    rows->cols = grid->cols;
+    rows->rows = count;
+    rows->width = grid->width;
+    rows->glyphs = grid->glyphs + start;
+    rows->bg = grid->bg + start;
+    rows->fg = grid->fg + start;
+}
+
+// Cells look the same if their glyphs and encoded colors are
+static inline int isSameCell(const CellGrid* a, const CellGrid* b, size_t i,
+                             ColorMode mode) {
+    if (a->glyphs[i] != b->glyphs[i])
+        return 0;
+    switch (mode) {
+        case COLOR_NONE:
+            return 1;
+        case COLOR_TRUE:
+            return a->bg[i] == b->bg[i] && a->fg[i] == b->fg[i];
+        default:
+            return encodeColor(mode, a->bg[i]) == encodeColor(mode, b->bg[i]) &&
+                   encodeColor(mode, a->fg[i]) == encodeColor(mode, b->fg[i]);
+    }
+}
+
+static void printCell(OutBuf* out, ColorState* state, const CellGrid* grid,
+                      size_t i) {
+    if (grid->width == 2) {
+        // Spaces only show the bg color
+        if (state->mode != COLOR_NONE)
+            setBgColor(out, state, grid->bg[i]);
+        outWrite(out, "  ", 2);
+    } else {
+        if (state->mode != COLOR_NONE)
+            setColors(out, state, grid->bg[i], grid->fg[i]);
+        outPutUtf8(out, grid->glyphs[i]);
+    }
+}
+
+// Format "\x1b[<n><cmd>"
+static void printCursorMove(OutBuf* out, int n, char cmd) {
+    char* p = reserveOutBuf(out, 16);
+    if (!p)
+        return;
+    p += sprintf(p, "\x1b[%d%c", n, cmd);
+    out->len = p - out->data;
+}
+
+void printCellRow(OutBuf* out, const CellGrid* grid, int row, ColorMode mode) {
+    ColorState state;
+    initColorState(&state, mode);
+    size_t start = (size_t)row * grid->cols;
+    for (int col = 0; col < grid->cols; col++) {
+        printCell(out, &state, grid, start + col);
+    }
+    if (mode != COLOR_NONE)
+        outWrite(out, "\x1b[m", 3);
+}
+
+void printCellGrid(OutBuf* out, const CellGrid* grid, const CellGrid* prev,
+                   ColorMode mode) {
+    if (!prev) {
+        for (int row = 0; row < grid->rows; row++) {
+            printCellRow(out, grid, row, mode);
+            outPutc(out, '\n');
+            checkOutBuf(out);
+        }
+        return;
+    }
+
+    ColorState state;
+    initColorState(&state, mode);
+
+    // Back to the first row, then down one row at a time
+    if (grid->rows > 0)
+        printCursorMove(out, grid->rows, 'A');
+    int changed = 0;
+    for (int row = 0; row < grid->rows; row++) {
+        size_t start = (size_t)row * grid->cols;
+        // The cursor is at the start of the row after a newline
+        int cursor = 0;
+        for (int col = 0; col < grid->cols; col++) {
+            if (isSameCell(grid, prev, start + col, mode))
+                continue;
+            // Columns are 1-based, an absolute move also keeps the cursor in
+            // place on terminals that draw a glyph wider than expected
+            if (col != cursor)
+                printCursorMove(out, col * grid->width + 1, 'G');
+            printCell(out, &state, grid, start + col);
+            cursor = col + 1;
+            changed = 1;
+        }
+        outPutc(out, '\n');
+        checkOutBuf(out);
+    }
+    if (changed && mode != COLOR_NONE)
+        outWrite(out, "\x1b[m", 3);
+}
@@ -0,0 +1,39 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdint.h>
+
+#include "color.h"
+#include "output.h"
+
+// Matched cells of an image, apart from their escape codes. Colors are kept
+// as RGB, so a grid can be printed in any color mode, or more than once,
+// without matching it again.
+typedef struct CellGrid {
+    int cols;
+    int rows;
+    // Terminal columns of a cell
+    int width;
+    // One entry per cell in row order, glyphs are packed as by UTF8_PACK
+    uint32_t* glyphs;
+    uint32_t* bg;
+    uint32_t* fg;
+} CellGrid;
+
+int initCellGrid(CellGrid* grid, int cols, int rows, int width);
+void freeCellGrid(CellGrid* grid);
+// Rows [row, row + count) of the grid as a grid sharing its cells, not to be
+// freed
+void getGridRows(const CellGrid* grid, int row, int count, CellGrid* rows);
+
+// Print a row of the grid without a line break, with the colors reset after
+// it. COLOR_NONE prints only the glyphs.
+void printCellRow(OutBuf* out, const CellGrid* grid, int row, ColorMode mode);
+
+// Print the grid, one line per cell row. If prev is set, the grid is assumed
+// to be on the screen just above the cursor as prev, and only the cells that
+// changed are printed between cursor moves.
+void printCellGrid(OutBuf* out, const CellGrid* grid, const CellGrid* prev,
+                   ColorMode mode);
+
+#endif
@@ -0,0 +1,192 @@
+#include "imgterm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "alpha.h"
+#include "cellcache.h"
+#include "enhance.h"
+#include "glyphs.h"
+#include "output.h"
+#include "pool.h"
+#include "render.h"
+#include "stb_image_resize.h"
+
+struct ImgtermContext {
+    ImgtermOptions opts;
+    RenderOptions render_opts;
+    GlyphSet glyphs;
+    // Reused between renders
+    uint32_t* pixels;
+    size_t pixels_cap;
+    OutBuf out;
+};
+
+void initImgtermOptions(ImgtermOptions* opts) {
+    opts->enhance_level = 2;
+    opts->color_mode = IMGTERM_COLOR_TRUE;
+    opts->cols = 0;
+    opts->rows = 0;
+    opts->jobs = 1;
+    opts->cache_entries = 4096;
+    opts->background = 0x000000;
+    opts->glyphs = NULL;
+}
+
+ImgtermContext* createImgtermContext(const ImgtermOptions* opts) {
+    if (opts->enhance_level < 0 || opts->enhance_level > 2 ||
+        opts->color_mode < IMGTERM_COLOR_TRUE ||
+        opts->color_mode > IMGTERM_COLOR_NONE || opts->cols < 0 ||
+        opts->rows < 0 || opts->jobs < 1 || opts->cache_entries < 0)
+        return NULL;
+
+    ImgtermContext* ctx = calloc(1, sizeof(ImgtermContext));
+    if (!ctx)
+        return NULL;
+    ctx->opts = *opts;
+    initEnhance();
+    initOutBuf(&ctx->out, -1, 0);
+
+    static const ColorMode color_modes[] = {COLOR_TRUE, COLOR_256,
+                                            COLOR_256_LUT, COLOR_NONE};
+    RenderOptions* render_opts = &ctx->render_opts;
+    render_opts->enhance_level = opts->enhance_level;
+    render_opts->color_mode = color_modes[opts->color_mode];
+    render_opts->jobs = opts->jobs;
+    render_opts->background.r = opts->background >> 16;
+    render_opts->background.g = opts->background >> 8;
+    render_opts->background.b = opts->background;
+    render_opts->background.a = 255;
+    initColorMode(render_opts->color_mode);
+    if (opts->glyphs) {
+        if (loadGlyphSet(&ctx->glyphs, opts->glyphs) != 0)
+            goto fail;
+        render_opts->glyphs = &ctx->glyphs;
+    }
+
+    if (opts->jobs > 1) {
+        render_opts->pool = createThreadPool(opts->jobs);
+        if (!render_opts->pool)
+            goto fail;
+    }
+    if (opts->cache_entries && opts->enhance_level == 2) {
+        render_opts->caches = calloc(opts->jobs, sizeof(CellCache));
+        if (!render_opts->caches)
+            goto fail;
+        for (int i = 0; i < opts->jobs; i++) {
+            if (initCellCache(&render_opts->caches[i], opts->cache_entries) !=
+                0)
+                goto fail;
+        }
+    }
+    return ctx;
+
+fail:
+    destroyImgtermContext(ctx);
+    return NULL;
+}
+
+void destroyImgtermContext(ImgtermContext* ctx) {
+    if (!ctx)
+        return;
+    RenderOptions* render_opts = &ctx->render_opts;
+    if (render_opts->caches) {
+        for (int i = 0; i < ctx->opts.jobs; i++) {
+            freeCellCache(&render_opts->caches[i]);
+        }
+        free(render_opts->caches);
+    }
+    if (render_opts->pool)
+        destroyThreadPool(render_opts->pool);
+    freeGlyphSet(&ctx->glyphs);
+    freeOutBuf(&ctx->out);
+    free(ctx->pixels);
+    free(ctx);
+}
+
+// Grow the buffer to hold count pixels
+static uint32_t* reservePixels(uint32_t** pixels, size_t* cap, size_t count) {
+    if (count > *cap) {
+        uint32_t* grow = realloc(*pixels, sizeof(uint32_t) * count);
+        if (!grow)
+            return NULL;
+        *pixels = grow;
+        *cap = count;
+    }
+    return *pixels;
+}
+
+// Pixel size of the image on the terminal
+static void getTargetSize(const ImgtermContext* ctx, int img_w, int img_h,
+                          int* target_w, int* target_h) {
+    int pixel_w, pixel_h;
+    getCellSize(ctx->opts.enhance_level, ctx->render_opts.glyphs, &pixel_w,
+                &pixel_h);
+    // A space is half as wide as the other glyphs, two make a cell
+    int cell_cols = ctx->opts.enhance_level == 0 ? 2 : 1;
+    int cols = ctx->opts.cols, rows = ctx->opts.rows;
+
+    *target_w = img_w;
+    *target_h = img_h;
+    if (cols)
+        *target_w = cols * pixel_w / cell_cols;
+    if (rows)
+        *target_h = rows * pixel_h;
+    if (cols && !rows)
+        *target_h = (int64_t)img_h * *target_w / img_w;
+    if (rows && !cols)
+        *target_w = (int64_t)img_w * *target_h / img_h;
+}
+
+// Render into ctx->out, return -1 on invalid arguments or out of memory
+static int renderToOutBuf(ImgtermContext* ctx, const uint8_t* rgba, int w,
+                          int h, int stride) {
+    if (!rgba || w <= 0 || h <= 0 || stride < 0 ||
+        (size_t)stride < (size_t)w * 4)
+        return -1;
+
+    int target_w, target_h;
+    getTargetSize(ctx, w, h, &target_w, &target_h);
+    if (target_w <= 0 || target_h <= 0)
+        return -1;
+    uint32_t* pixels = reservePixels(&ctx->pixels, &ctx->pixels_cap,
+                                     (size_t)target_w * target_h);
+    if (!pixels)
+        return -1;
+    if (ctx->opts.cols || ctx->opts.rows) {
+        // Straight from the rows of the caller
+        if (!stbir_resize_uint8(rgba, w, h, stride, (uint8_t*)pixels,
+                                target_w, target_h,
+                                sizeof(uint32_t) * target_w, 4))
+            return -1;
+    } else {
+        // The alpha pass works in place, so the rows are copied
+        for (int y = 0; y < h; y++) {
+            memcpy(pixels + (size_t)y * w, rgba + (size_t)y * stride,
+                   sizeof(uint32_t) * w);
+        }
+    }
+
+    blendAlpha(pixels, target_w, target_h, ctx->render_opts.background);
+    ctx->out.len = 0;
+    ctx->out.failed = 0;
+    return renderImage(&ctx->out, pixels, target_w, target_h,
+                       &ctx->render_opts);
+}
+
+int renderImgterm(ImgtermContext* ctx, const uint8_t* rgba, int w, int h,
+                  int stride, ImgtermWriteFunc write, void* user) {
+    if (renderToOutBuf(ctx, rgba, w, h, stride) != 0)
+        return -1;
+    return write(user, ctx->out.data, ctx->out.len) ? -1 : 0;
+}
+
+ptrdiff_t renderImgtermToBuffer(ImgtermContext* ctx, const uint8_t* rgba,
+                                int w, int h, int stride, char* buf,
+                                size_t size) {
+    if (renderToOutBuf(ctx, rgba, w, h, stride) != 0)
+        return -1;
+    if (ctx->out.len)
+        memcpy(buf, ctx->out.data, ctx->out.len < size ? ctx->out.len : size);
+    return ctx->out.len;
+}
@@ -0,0 +1,84 @@
+#ifndef IMGTERM_H
+#define IMGTERM_H
+
+// Public API of libimgterm. Contexts do not share any mutable state, so
+// different threads can render with their own contexts at the same time.
+// A single context must not be used by two threads at once. Running out of
+// memory is returned as a failure, the library never exits the process.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define IMGTERM_API __attribute__((visibility("default")))
+#else
+#define IMGTERM_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum ImgtermColorMode {
+    IMGTERM_COLOR_TRUE,
+    IMGTERM_COLOR_256,
+    // 256 colors from a lookup table, faster and approximate
+    IMGTERM_COLOR_256_LUT,
+    // Only the glyphs, without colors
+    IMGTERM_COLOR_NONE,
+} ImgtermColorMode;
+
+typedef struct ImgtermOptions {
+    // 0 = Use space, 1 = Use lower half block, 2 = Use more unicode characters
+    int enhance_level;
+    ImgtermColorMode color_mode;
+    // Size in terminal columns and rows to resize the image to. If only one
+    // is set the other follows the aspect ratio, if neither is set the
+    // image is rendered at its raw size.
+    int cols;
+    int rows;
+    // Render threads owned by the context, 1 renders on the calling thread
+    int jobs;
+    // Matched cells to cache per job, 0 to disable
+    int cache_entries;
+    // Color transparent pixels are blended over, as 0xRRGGBB
+    uint32_t background;
+    // Glyph set file to match at enhance level 2, as for the --glyphs option
+    // of the imgterm command, or NULL for the default glyphs. Why it cannot
+    // be loaded is printed to stderr.
+    const char* glyphs;
+} ImgtermOptions;
+
+typedef struct ImgtermContext ImgtermContext;
+
+// Called with the output, return non-zero to stop rendering
+typedef int (*ImgtermWriteFunc)(void* user, const char* data, size_t len);
+
+// Fill in the defaults of the imgterm command
+IMGTERM_API void initImgtermOptions(ImgtermOptions* opts);
+
+// Return NULL if the options are invalid, the glyph set cannot be loaded or
+// out of memory
+IMGTERM_API ImgtermContext* createImgtermContext(const ImgtermOptions* opts);
+IMGTERM_API void destroyImgtermContext(ImgtermContext* ctx);
+
+// Render w x h RGBA pixels, rows stride bytes apart, and pass the output to
+// write. Return 0 on success, -1 on invalid arguments, out of memory or if
+// write stopped. Nothing is written if it fails before write is called.
+IMGTERM_API int renderImgterm(ImgtermContext* ctx, const uint8_t* rgba, int w,
+                              int h, int stride, ImgtermWriteFunc write,
+                              void* user);
+
+// Render into buf, return the length of the whole output like snprintf, or
+// -1 on invalid arguments or out of memory. The output is not NUL-terminated
+// and is cut short if it is longer than size.
+IMGTERM_API ptrdiff_t renderImgtermToBuffer(ImgtermContext* ctx,
+                                            const uint8_t* rgba, int w, int h,
+                                            int stride, char* buf,
+                                            size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,13 +1,34 @@
+#include <dirent.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "anim.h"
+#include "batch.h"
 #include "color.h"
+#include "daemon.h"
+#include "diskcache.h"
 #include "enhance.h"
-#include "stb_image.h"
-#include "stb_image_resize.h"
+#include "glyphs.h"
+#include "output.h"
+#include "pool.h"
+#include "render.h"
+#include "sheet.h"
+#include "stats.h"
+#include "stream.h"
+
+// Decoded and resized images kept by the daemon
+#define DAEMON_CACHE_BYTES (256 << 20)
+// Most decoded and resized pixels to hold for files ahead of the one shown
+#define DECODE_AHEAD_BYTES (256 << 20)
+// Default size of the on-disk output cache in MiB
+#define DISK_CACHE_MIB 100
 
 static int getWindowSize(int* rows, int* cols) {
     struct winsize ws;
@@ -19,8 +40,118 @@ static int getWindowSize(int* rows, int* cols) {
     return 0;
 }
 
+// Play a stream from the file, or stdin if file_path is NULL
+static int showStream(const char* file_path, StreamFormat format, int width,
+                      int height, double fps, const SizeOptions* size_opts,
+                      int raw_size, OutBuf* out, const RenderOptions* opts,
+                      Stats* stats) {
+    int fd = STDIN_FILENO;
+    if (file_path) {
+        fd = open(file_path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Cannot open file %s\n", file_path);
+            return -1;
+        }
+    }
+
+    Stream stream;
+    int ret = openStream(&stream, fd, format, width, height);
+    if (ret == 0) {
+        int resize_w = 0, resize_h = 0;
+        if (!raw_size)
+            getResizeSize(size_opts, stream.width, stream.height, &resize_w,
+                          &resize_h);
+        ret = playStream(out, &stream, fps, resize_w, resize_h, opts, stats);
+        closeStream(&stream);
+    }
+    if (file_path)
+        close(fd);
+    return ret;
+}
+
+// RRGGBB in hex, with an optional leading #
+static int parseColor(const char* s, Color* color) {
+    if (*s == '#')
+        s++;
+    if (strspn(s, "0123456789abcdefABCDEF") != 6 || s[6] != '\0')
+        return -1;
+    unsigned long rgb = strtoul(s, NULL, 16);
+    color->r = rgb >> 16;
+    color->g = rgb >> 8;
+    color->b = rgb;
+    color->a = 255;
+    return 0;
+}
+
+static int isImageName(const char* name) {
+    static const char* extensions[] = {"png", "jpg", "jpeg", "gif", "bmp",
+                                       "tga", "psd", "hdr", "pic", "pnm",
+                                       "ppm", "pgm"};
+    const char* dot = strrchr(name, '.');
+    if (!dot)
+        return 0;
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(*extensions); i++) {
+        if (strcasecmp(dot + 1, extensions[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int compareNames(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Replace each directory with the images in it, sorted by name
+static char** expandDirectories(char* files[], int* count) {
+    int cap = *count + 16;
+    int n = 0;
+    char** expanded = malloc(sizeof(char*) * cap);
+    for (int i = 0; expanded && i < *count; i++) {
+        struct stat st;
+        DIR* dir = NULL;
+        if (strcmp(files[i], "-") != 0 && stat(files[i], &st) == 0 &&
+            S_ISDIR(st.st_mode))
+            dir = opendir(files[i]);
+        if (!dir) {
+            if (n == cap)
+                expanded = realloc(expanded, sizeof(char*) * (cap *= 2));
+            if (expanded)
+                expanded[n++] = files[i];
+            continue;
+        }
+
+        int start = n;
+        struct dirent* entry;
+        while (expanded && (entry = readdir(dir))) {
+            if (entry->d_name[0] == '.' || !isImageName(entry->d_name))
+                continue;
+            if (n == cap)
+                expanded = realloc(expanded, sizeof(char*) * (cap *= 2));
+            size_t len = strlen(files[i]) + strlen(entry->d_name) + 2;
+            char* path = malloc(len);
+            if (!expanded || !path)
+                break;
+            snprintf(path, len, "%s/%s", files[i], entry->d_name);
+            expanded[n++] = path;
+        }
+        closedir(dir);
+        if (expanded)
+            qsort(expanded + start, n - start, sizeof(char*), compareNames);
+    }
+    if (!expanded) {
+        fprintf(stderr, "Cannot allocate memory for file list\n");
+        exit(EXIT_FAILURE);
+    }
+    *count = n;
+    return expanded;
+}
+
 static void usage(const char* prog) {
     fprintf(stderr, "Usage: %s [options] [files]\n", prog);
+    fprintf(stderr,
+            "Read stdin for \"-\", or if it is not a terminal and no files "
+            "are given\n");
+    fprintf(stderr, "Directories are replaced with the images in them\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "    -w width\n");
     fprintf(stderr,
@@ -40,6 +171,99 @@ static void usage(const char* prog) {
     fprintf(stderr, "        2 = Use more unicode characters\n");
     fprintf(stderr, "    -r  Use the raw size of the image\n");
     fprintf(stderr, "    -8  Use 8-bit colors\n");
+    fprintf(stderr,
+            "    -l  Use 8-bit colors from a lookup table (faster, "
+            "approximate)\n");
+    fprintf(stderr,
+            "    -t  Print only the glyphs, without colors (for -e 2)\n");
+    fprintf(stderr, "    -b color\n");
+    fprintf(stderr,
+            "        Background to blend transparent pixels over, as RRGGBB "
+            "in hex\n");
+    fprintf(stderr, "        (Default=000000)\n");
+    fprintf(stderr, "    -j jobs\n");
+    fprintf(stderr,
+            "        Number of render threads. Use all CPUs if set to 0 "
+            "(Default=1)\n");
+    fprintf(stderr, "    -d threads\n");
+    fprintf(stderr,
+            "        Threads decoding the next files while one is shown. "
+            "Decode\n");
+    fprintf(stderr, "        one file at a time if set to 0 (Default=1)\n");
+    fprintf(stderr, "    -c bytes\n");
+    fprintf(stderr,
+            "        Output chunk size. Flush once per image if set to 0 "
+            "(Default=0)\n");
+    fprintf(stderr, "    -m entries\n");
+    fprintf(stderr,
+            "        Matched cells to cache per job. Disable if set to 0 "
+            "(Default=4096)\n");
+    fprintf(stderr, "    -a loops\n");
+    fprintf(stderr,
+            "        Play animated GIFs this many times. Loop forever if set "
+            "to 0\n");
+    fprintf(stderr, "    -g columns\n");
+    fprintf(stderr,
+            "        Show the files as a grid of thumbnails, this many per "
+            "row\n");
+    fprintf(stderr,
+            "        -w and -h set the terminal columns and rows of a "
+            "thumbnail\n");
+    fprintf(stderr, "    -s format\n");
+    fprintf(stderr,
+            "        Show a video stream from stdin or the file as it "
+            "arrives\n");
+    fprintf(stderr, "        rgba:WxH = Raw RGBA frames of W x H pixels\n");
+    fprintf(stderr, "        y4m = YUV4MPEG2\n");
+    fprintf(stderr, "    -f fps\n");
+    fprintf(stderr,
+            "        Most frames per second to show of a stream, the rest are "
+            "dropped\n");
+    fprintf(stderr,
+            "        Use the stream frame rate or 30 if set to 0 "
+            "(Default=0)\n");
+    fprintf(stderr, "    --daemon[=socket]\n");
+    fprintf(stderr,
+            "        Serve render requests on a Unix socket, keeping decoded "
+            "images\n");
+    fprintf(stderr,
+            "        in memory (Default=$XDG_RUNTIME_DIR/imgterm.sock)\n");
+    fprintf(stderr, "    --client[=socket]\n");
+    fprintf(stderr,
+            "        Render the files through the daemon. Use stdin for "
+            "\"-\"\n");
+    fprintf(stderr, "    --cache[=MiB]\n");
+    fprintf(stderr,
+            "        Keep the output of each file in $XDG_CACHE_HOME/imgterm, "
+            "up to\n");
+    fprintf(stderr, "        this size (Default=%d)\n", DISK_CACHE_MIB);
+    fprintf(stderr, "    --cache-hash\n");
+    fprintf(stderr,
+            "        Also key the cache by the file content, not only its "
+            "size,\n");
+    fprintf(stderr, "        inode and modification time\n");
+    fprintf(stderr, "    --glyphs=file\n");
+    fprintf(stderr,
+            "        Match the glyphs of the file at enhance level 2, a text "
+            "definition\n");
+    fprintf(stderr, "        or one compiled with --compile-glyphs\n");
+    fprintf(stderr, "    --compile-glyphs=file\n");
+    fprintf(stderr,
+            "        Write the glyph set compiled from the text definition to "
+            "stdout\n");
+    fprintf(stderr, "    --rasterize-glyphs=font\n");
+    fprintf(stderr,
+            "        Write the text definition to stdout with masks drawn "
+            "from the\n");
+    fprintf(stderr, "        glyphs of the BDF or PSF font\n");
+    fprintf(stderr, "    --cell=WxH\n");
+    fprintf(stderr,
+            "        Pixels per cell for --rasterize-glyphs (Default=4x8)\n");
+    fprintf(stderr, "    --stats[=json]\n");
+    fprintf(stderr,
+            "        Print stage times and output size of each file to "
+            "stderr\n");
+    fprintf(stderr, "        json = One JSON object per line\n");
     fprintf(stderr, "    -?  Print this help\n");
 }
 
@@ -48,7 +272,8 @@ int main(int argc, char* argv[]) {
         exit(EXIT_FAILURE);
 
     const char* prog = argv[0];
-    if (argc < 2) {
+    // An image can also be piped in without any arguments
+    if (argc < 2 && isatty(STDIN_FILENO)) {
         usage(prog);
         exit(EXIT_FAILURE);
     }
@@ -57,11 +282,62 @@ int main(int argc, char* argv[]) {
     int screen_percentage = 50;
     int raw_size = 0;
     int enhance_level = 2;
+    int jobs = 1;
+    int decoders = 1;
+    // Show the images one after another if 0
+    int sheet_columns = 0;
+    int chunk = 0;
+    int cache_entries = 4096;
+    // Show only the first frame of animations if negative
+    int loops = -1;
+    int stream_input = 0;
+    StreamFormat stream_format = STREAM_RGBA;
+    int stream_w = 0, stream_h = 0;
+    double fps = 0;
+    const char* daemon_socket = NULL;
+    const char* client_socket = NULL;
+    char default_socket[256];
+    getDaemonSocketPath(default_socket, sizeof(default_socket));
+    int use_disk_cache = 0;
+    long disk_cache_mib = DISK_CACHE_MIB;
+    int hash_content = 0;
+    const char* glyphs_path = NULL;
+    const char* compile_glyphs = NULL;
+    const char* rasterize_font = NULL;
+    int cell_w = 4, cell_h = 8;
+
+    ColorMode color_mode = COLOR_TRUE;
+    Color background = {.a = 255};
+    int show_stats = 0;
+    StatsFormat stats_format = STATS_TEXT;
 
-    SetColorFunc setColor = setTrueColor;
+    enum {
+        OPT_STATS = 256,
+        OPT_DAEMON,
+        OPT_CLIENT,
+        OPT_CACHE,
+        OPT_CACHE_HASH,
+        OPT_GLYPHS,
+        OPT_COMPILE_GLYPHS,
+        OPT_RASTERIZE_GLYPHS,
+        OPT_CELL,
+    };
+    static const struct option long_opts[] = {
+        {"stats", optional_argument, NULL, OPT_STATS},
+        {"daemon", optional_argument, NULL, OPT_DAEMON},
+        {"client", optional_argument, NULL, OPT_CLIENT},
+        {"cache", optional_argument, NULL, OPT_CACHE},
+        {"cache-hash", no_argument, NULL, OPT_CACHE_HASH},
+        {"glyphs", required_argument, NULL, OPT_GLYPHS},
+        {"compile-glyphs", required_argument, NULL, OPT_COMPILE_GLYPHS},
+        {"rasterize-glyphs", required_argument, NULL, OPT_RASTERIZE_GLYPHS},
+        {"cell", required_argument, NULL, OPT_CELL},
+        {NULL, 0, NULL, 0},
+    };
 
     int opt;
-    while ((opt = getopt(argc, argv, "w:h:p:re:8?")) != -1) {
+    while ((opt = getopt_long(argc, argv, "w:h:p:re:8ltb:j:d:c:m:a:g:s:f:?",
+                              long_opts, NULL)) != -1) {
         switch (opt) {
             case 'w':
                 target_w = atoi(optarg);
@@ -88,7 +364,13 @@ int main(int argc, char* argv[]) {
                 raw_size = 1;
                 break;
             case '8':
-                setColor = set256Color;
+                color_mode = COLOR_256;
+                break;
+            case 'l':
+                color_mode = COLOR_256_LUT;
+                break;
+            case 't':
+                color_mode = COLOR_NONE;
                 break;
             case 'e':
                 enhance_level = atoi(optarg);
@@ -98,8 +380,122 @@ int main(int argc, char* argv[]) {
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'b':
+                if (parseColor(optarg, &background) != 0) {
+                    fprintf(stderr, "Background should be RRGGBB in hex\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                if (jobs < 0) {
+                    fprintf(stderr, "Jobs cannot be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'd':
+                decoders = atoi(optarg);
+                if (decoders < 0) {
+                    fprintf(stderr, "Decode threads cannot be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                chunk = atoi(optarg);
+                if (chunk < 0) {
+                    fprintf(stderr, "Chunk size cannot be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm':
+                cache_entries = atoi(optarg);
+                if (cache_entries < 0) {
+                    fprintf(stderr, "Cache entries cannot be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'a':
+                loops = atoi(optarg);
+                if (loops < 0) {
+                    fprintf(stderr, "Loops cannot be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g':
+                sheet_columns = atoi(optarg);
+                if (sheet_columns < 1) {
+                    fprintf(stderr, "Grid columns should be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                if (parseStreamFormat(optarg, &stream_format, &stream_w,
+                                      &stream_h) != 0) {
+                    fprintf(stderr,
+                            "Stream format should be rgba:WxH or y4m\n");
+                    exit(EXIT_FAILURE);
+                }
+                stream_input = 1;
+                break;
+            case 'f':
+                fps = atof(optarg);
+                if (fps < 0) {
+                    fprintf(stderr, "Frame rate cannot be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_STATS:
+                show_stats = 1;
+                if (!optarg || strcmp(optarg, "text") == 0) {
+                    stats_format = STATS_TEXT;
+                } else if (strcmp(optarg, "json") == 0) {
+                    stats_format = STATS_JSON;
+                } else {
+                    fprintf(stderr, "Stats format should be text or json\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_DAEMON:
+                daemon_socket = optarg ? optarg : default_socket;
+                break;
+            case OPT_CLIENT:
+                client_socket = optarg ? optarg : default_socket;
+                break;
+            case OPT_CACHE:
+                use_disk_cache = 1;
+                if (optarg) {
+                    disk_cache_mib = atol(optarg);
+                    if (disk_cache_mib <= 0) {
+                        fprintf(stderr, "Cache size should be positive\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                break;
+            case OPT_CACHE_HASH:
+                use_disk_cache = 1;
+                hash_content = 1;
+                break;
+            case OPT_GLYPHS:
+                glyphs_path = optarg;
+                break;
+            case OPT_COMPILE_GLYPHS:
+                compile_glyphs = optarg;
+                break;
+            case OPT_RASTERIZE_GLYPHS:
+                rasterize_font = optarg;
+                break;
+            case OPT_CELL:
+                if (parseCellSize(optarg, &cell_w, &cell_h) != 0) {
+                    fprintf(stderr,
+                            "Cell size should be WxH of a multiple of 32 "
+                            "pixels, up to %d\n",
+                            MATCH_MAX_PIXELS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             default:
-                if (optopt == 0) {
+                // Unknown long options also leave optopt unset
+                if (optopt == 0 && strncmp(argv[optind - 1], "--", 2) != 0) {
                     usage(prog);
                     exit(EXIT_SUCCESS);
                 }
@@ -108,133 +504,296 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    for (int i = optind; i < argc; i++) {
-        const char* file_path = argv[i];
-        int img_w, img_h;
-        uint32_t* img =
-            (uint32_t*)stbi_load(file_path, &img_w, &img_h, NULL, 4);
-        if (!img) {
-            fprintf(stderr, "Cannot open file %s\n", file_path);
+    if (compile_glyphs) {
+        GlyphSet glyph_set;
+        if (loadGlyphSet(&glyph_set, compile_glyphs) != 0)
+            exit(EXIT_FAILURE);
+        OutBuf out;
+        initOutBuf(&out, STDOUT_FILENO, 0);
+        outWrite(&out, (const char*)glyph_set.file.data, glyph_set.file.len);
+        flushOutBuf(&out);
+        freeOutBuf(&out);
+        freeGlyphSet(&glyph_set);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (rasterize_font) {
+        if (optind != argc - 1) {
+            fprintf(stderr, "Give one glyph set to rasterize\n");
             exit(EXIT_FAILURE);
         }
+        BitmapFont font;
+        if (loadBitmapFont(&font, rasterize_font) != 0)
+            exit(EXIT_FAILURE);
+        OutBuf out;
+        initOutBuf(&out, STDOUT_FILENO, 0);
+        int ret =
+            rasterizeGlyphSet(&out, argv[optind], &font, cell_w, cell_h);
+        flushOutBuf(&out);
+        freeOutBuf(&out);
+        freeBitmapFont(&font);
+        exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
-        int pixel_w, pixel_h;
-        switch (enhance_level) {
-            case 0:
-                pixel_w = 1;
-                pixel_h = 1;
-                break;
-            case 1:
-                pixel_w = 1;
-                pixel_h = 2;
-                break;
-            default:
-                pixel_w = 4;
-                pixel_h = 8;
-        }
-
-        uint32_t* pixels = img;
-        uint32_t* resize = NULL;
-        if (!raw_size) {
-            int resize_h = 0, resize_w = 0;
-            int screen_w = 120, screen_h = 30;
-            getWindowSize(&screen_h, &screen_w);
-
-            // For converting screen size to pixel size
-            float mul_w, mul_h;
-            switch (enhance_level) {
-                case 0:
-                    mul_w = 0.5f;
-                    mul_h = 1.0f;
-                    break;
-                case 1:
-                    mul_w = 1.0f;
-                    mul_h = 2.0f;
-                    break;
-                default:
-                    mul_w = 4.0f;
-                    mul_h = 8.0f;
-            }
+    char** files = argv + optind;
+    int file_count = argc - optind;
+    static char* stdin_files[] = {"-"};
+    if (file_count == 0 && !stream_input && !daemon_socket &&
+        !isatty(STDIN_FILENO)) {
+        files = stdin_files;
+        file_count = 1;
+    }
+    if (!stream_input)
+        files = expandDirectories(files, &file_count);
 
-            screen_w *= mul_w;
-            screen_h *= mul_h;
-
-            if (target_w == -1 && target_h == -1) {
-                // Both not set, use screen size
-                resize_h = screen_h * screen_percentage / 100.0f;
-                resize_w = img_w * resize_h / img_h;
-                if (resize_w > screen_w) {
-                    resize_w = screen_w;
-                    resize_h = img_h * resize_w / img_w;
-                }
-            } else {
-                if (target_w != -1) {
-                    resize_w = target_w ? target_w * mul_w : screen_w;
-                    if (target_h == -1) {
-                        resize_h = img_h * resize_w / img_w;
-                    }
-                }
-                if (target_h != -1) {
-                    resize_h = target_h ? target_h * mul_h : screen_h;
-                    if (target_w == -1) {
-                        resize_w = img_w * resize_h / img_h;
-                    }
-                }
-            }
+    SizeOptions size_opts = {.target_w = target_w,
+                             .target_h = target_h,
+                             .screen_percentage = screen_percentage,
+                             .enhance_level = enhance_level,
+                             .screen_cols = 120,
+                             .screen_rows = 30};
+    getWindowSize(&size_opts.screen_rows, &size_opts.screen_cols);
+
+    if (client_socket) {
+        if (glyphs_path) {
+            fprintf(stderr, "Set the glyph set when starting the daemon\n");
+            exit(EXIT_FAILURE);
+        }
+        DaemonRequest request = {.magic = DAEMON_MAGIC,
+                                 .size = size_opts,
+                                 .raw_size = raw_size,
+                                 .color_mode = color_mode,
+                                 .background = background.color};
+        if (runClient(client_socket, &request, files, file_count) != 0)
+            exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+    }
+
+    initEnhance();
+    GlyphSet glyph_set;
+    const GlyphSet* glyphs = getDefaultGlyphSet();
+    if (glyphs_path) {
+        if (loadGlyphSet(&glyph_set, glyphs_path) != 0)
+            exit(EXIT_FAILURE);
+        glyphs = &glyph_set;
+    }
+    getCellSize(2, glyphs, &size_opts.cell_w, &size_opts.cell_h);
+
+    if (jobs == 0) {
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        if (jobs < 1)
+            jobs = 1;
+    }
+    RenderOptions render_opts = {.enhance_level = enhance_level,
+                                 .color_mode = color_mode,
+                                 .jobs = jobs,
+                                 .background = background,
+                                 .glyphs = glyphs};
+    if (jobs > 1) {
+        render_opts.pool = createThreadPool(jobs);
+        if (!render_opts.pool) {
+            fprintf(stderr, "Cannot create render threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-            resize = malloc(sizeof(uint32_t) * resize_w * resize_h);
-            if (!resize) {
-                fprintf(stderr, "Cannot allocate memory for resize image\n");
+    // Requests to the daemon may use any enhance level
+    if (cache_entries && (enhance_level == 2 || daemon_socket)) {
+        render_opts.caches = calloc(jobs, sizeof(CellCache));
+        if (!render_opts.caches) {
+            fprintf(stderr, "Cannot allocate memory for cell cache\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < jobs; i++) {
+            if (initCellCache(&render_opts.caches[i], cache_entries) != 0) {
+                fprintf(stderr, "Cannot allocate memory for cell cache\n");
                 exit(EXIT_FAILURE);
             }
-            stbir_resize_uint8((uint8_t*)img, img_w, img_h,
-                               sizeof(uint32_t) * img_w, (uint8_t*)resize,
-                               resize_w, resize_h, sizeof(uint32_t) * resize_w,
-                               4);
-            img_w = resize_w;
-            img_h = resize_h;
-            pixels = resize;
-        }
-
-        // handle alpha
-        for (int x = 0; x < img_h; x++) {
-            for (int y = 0; y < img_w; y++) {
-                Color* c = (Color*)&pixels[x * img_w + y];
-                c->r *= c->a / 255.0f;
-                c->g *= c->a / 255.0f;
-                c->b *= c->a / 255.0f;
-            }
         }
+    }
 
-        for (int x = 0; x + pixel_h <= img_h; x += pixel_h) {
-            for (int y = 0; y + pixel_w <= img_w; y += pixel_w) {
-                switch (enhance_level) {
-                    case 0:
-                        setColor(pixels[x * img_w + y], 1);
-                        printf("  ");
-                        break;
-                    case 1:
-                        setColor(pixels[x * img_w + y], 1);
-                        setColor(pixels[(x + 1) * img_w + y], 0);
-                        printf("\u2584");
-                        break;
-                    default: {
-                        Color block[8][4];
-                        for (int x1 = 0; x1 < 8; x1++) {
-                            for (int y1 = 0; y1 < 4; y1++) {
-                                block[x1][y1].color =
-                                    pixels[(x + x1) * img_w + (y + y1)];
-                            }
-                        }
-                        printClosestShape(block, setColor);
-                    }
+    if (daemon_socket) {
+        runDaemon(daemon_socket, &render_opts, DAEMON_CACHE_BYTES);
+        exit(EXIT_FAILURE);
+    }
+
+    Stats file_stats;
+    Stats* stats = show_stats ? &file_stats : NULL;
+    StageTime start;
+
+    OutBuf out;
+    initOutBuf(&out, STDOUT_FILENO, chunk);
+    out.stats = stats;
+
+    DiskCache disk_cache;
+    if (use_disk_cache && initDiskCache(&disk_cache, disk_cache_mib << 20,
+                                        hash_content) != 0) {
+        fprintf(stderr, "Cannot create cache directory\n");
+        exit(EXIT_FAILURE);
+    }
+    // Output is collected here to be cached before it is written
+    OutBuf cache_out;
+    initOutBuf(&cache_out, -1, 0);
+
+    if (stream_input) {
+        const char* file_path = file_count ? files[0] : NULL;
+        if (file_path && strcmp(file_path, "-") == 0)
+            file_path = NULL;
+        memset(&file_stats, 0, sizeof(file_stats));
+        if (showStream(file_path, stream_format, stream_w, stream_h, fps,
+                       &size_opts, raw_size, &out, &render_opts, stats) != 0)
+            exit(EXIT_FAILURE);
+        if (stats)
+            printStats(stderr, stats, file_path ? file_path : "stdin",
+                       stats_format);
+        // The stream is the only input
+        file_count = 0;
+    }
+
+    for (int i = 0; loops >= 0 && i < file_count; i++) {
+        const char* file_path = files[i];
+        memset(&file_stats, 0, sizeof(file_stats));
+
+        Animation anim;
+        startStage(stats, &start);
+        int ret = loadAnimation(&anim, file_path);
+        endStage(stats, STAT_DECODE, &start);
+        if (ret != 0) {
+            fprintf(stderr, "Cannot open file %s\n", file_path);
+            exit(EXIT_FAILURE);
+        }
+        int resize_w = 0, resize_h = 0;
+        if (!raw_size)
+            getResizeSize(&size_opts, anim.img_w, anim.img_h, &resize_w,
+                          &resize_h);
+        playAnimation(&out, &anim, resize_w, resize_h,
+                      anim.frame_count > 1 ? loops : 1, &render_opts, stats);
+        freeAnimation(&anim);
+        if (stats)
+            printStats(stderr, stats, file_path, stats_format);
+    }
+    if (loops >= 0)
+        file_count = 0;
+
+    if (sheet_columns > 0) {
+        SheetOptions sheet;
+        initSheetOptions(&sheet, sheet_columns, &size_opts);
+        SizeOptions tile_size;
+        getTileSizeOptions(&sheet, &size_opts, &tile_size);
+        LoadOptions load_opts = {.size = &tile_size,
+                                 .output = {.background = background.color},
+                                 .time_stages = show_stats};
+        ImageQueue* queue = createImageQueue(files, file_count, decoders,
+                                             DECODE_AHEAD_BYTES, &load_opts);
+        if (!queue) {
+            fprintf(stderr, "Cannot create decode threads\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(&file_stats, 0, sizeof(file_stats));
+        showSheet(&out, queue, &sheet, &render_opts, stats);
+        destroyImageQueue(queue);
+        if (stats)
+            printStats(stderr, stats, "grid", stats_format);
+        file_count = 0;
+    }
+
+    LoadOptions load_opts = {.size = &size_opts,
+                             .raw_size = raw_size,
+                             .cache = use_disk_cache ? &disk_cache : NULL,
+                             .output = {.enhance_level = enhance_level,
+                                        .color_mode = color_mode,
+                                        .background = background.color,
+                                        .glyphs = glyphs->id},
+                             .time_stages = show_stats,
+                             .defer_resize = 1};
+    ImageQueue* queue = createImageQueue(files, file_count, decoders,
+                                         DECODE_AHEAD_BYTES, &load_opts);
+    if (!queue) {
+        fprintf(stderr, "Cannot create decode threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    LoadedImage* image;
+    while ((image = nextImage(queue))) {
+        const char* file_path = image->file_path;
+        // Decode times come from the loading thread
+        file_stats = image->stats;
+
+        if (image->cached) {
+            startStage(stats, &start);
+            int64_t len =
+                copyCachedOutput(&disk_cache, image->key, STDOUT_FILENO);
+            endStage(stats, STAT_WRITE, &start);
+            if (len >= 0) {
+                if (stats) {
+                    stats->bytes = len;
+                    printStats(stderr, stats, file_path, stats_format);
                 }
+                continue;
             }
-            printf("\x1b[m\n");
+            // Evicted since it was looked up
+            uint64_t key = image->key;
+            loadImage(image, file_path, &load_opts, 0);
+            image->key = key;
+            file_stats = image->stats;
         }
+        if (image->status != 0) {
+            fprintf(stderr, "Cannot open file %s\n", file_path);
+            exit(EXIT_FAILURE);
+        }
+
+        // Writes during the render are timed on their own, leave them out
+        StageTime write_start = file_stats.stages[STAT_WRITE];
+        startStage(stats, &start);
+        OutBuf* dest = image->key ? &cache_out : &out;
+        int ret;
+        if (image->deferred)
+            ret = renderScaledImage(dest, image->pixels, image->src_w,
+                                    image->src_h, image->w, image->h,
+                                    image->alpha, &render_opts);
+        else
+            ret = renderImage(dest, image->pixels, image->w, image->h,
+                              &render_opts);
+        if (ret != 0) {
+            fprintf(stderr, "Cannot allocate memory for render\n");
+            exit(EXIT_FAILURE);
+        }
+        endStage(stats, STAT_RENDER, &start);
+        // Release the pixels before writing
+        freeLoadedImage(image);
+        if (image->key) {
+            storeCachedOutput(&disk_cache, image->key, cache_out.data,
+                              cache_out.len);
+            outWrite(&out, cache_out.data, cache_out.len);
+            cache_out.len = 0;
+        }
+        flushOutBuf(&out);
 
-        free(resize);
-        stbi_image_free(img);
+        if (stats) {
+            StageTime* render = &stats->stages[STAT_RENDER];
+            render->wall -= stats->stages[STAT_WRITE].wall - write_start.wall;
+            render->cpu -= stats->stages[STAT_WRITE].cpu - write_start.cpu;
+
+            int pixel_w, pixel_h;
+            getCellSize(enhance_level, glyphs, &pixel_w, &pixel_h);
+            stats->cells =
+                (uint64_t)(image->h / pixel_h) * (image->w / pixel_w);
+            printStats(stderr, stats, file_path, stats_format);
+        }
+    }
+    destroyImageQueue(queue);
+
+    freeOutBuf(&out);
+    freeOutBuf(&cache_out);
+    if (render_opts.caches) {
+        for (int i = 0; i < jobs; i++) {
+            freeCellCache(&render_opts.caches[i]);
+        }
+        free(render_opts.caches);
     }
+    if (render_opts.pool)
+        destroyThreadPool(render_opts.pool);
+    if (glyphs_path)
+        freeGlyphSet(&glyph_set);
     exit(EXIT_SUCCESS);
 }
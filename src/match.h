@@ -0,0 +1,87 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "color.h"
+
+// Vector matchers process glyphs in batches of this size
+#define MATCH_BATCH 8
+// and in batches of this size for cells of more than 32 pixels
+#define MATCH_WIDE_BATCH 32
+
+// Largest cell, the channel sums of its pixels fit in 16 bits
+#define MATCH_MAX_PIXELS 256
+#define MATCH_MAX_WORDS (MATCH_MAX_PIXELS / 32)
+
+// Integer division by a group size n <= 32 of a channel sum <= 32 * 255 is
+// exact as (sum * recip[n]) >> MATCH_RECIP_SHIFT
+#define MATCH_RECIP_SHIFT 18
+
+// Glyph masks laid out for the matchers. The arrays are padded with empty
+// masks to stride entries, a multiple of MATCH_BATCH, or of MATCH_WIDE_BATCH
+// if a mask has more than one word, so the vector code can always process
+// whole batches.
+typedef struct MatchTable {
+    size_t count;
+    size_t stride;
+    // A mask covers the pixels of the cell in rows from the top left, the
+    // first pixel is the highest bit of the first word. Word w of glyph i is
+    // masks[w * stride + i].
+    int words;
+    const uint32_t* masks;
+    // Pixels 4k to 4k + 3 of glyph i, as the hex digit k of its mask, are
+    // nibbles[k * stride + i]
+    const uint8_t* nibbles;
+    const int32_t* fg_count;
+    const int32_t* bg_count;
+    // Only exact for the counts of a single word
+    const uint32_t* fg_recip;
+    const uint32_t* bg_recip;
+} MatchTable;
+
+// Find the closest glyph of the cell, return its index in the table and
+// store the bg and fg colors in colors[0] and colors[1]. hint is a likely
+// match, like the glyph of the left cell. It does not change the result.
+typedef size_t (*MatchFunc)(const MatchTable* table, Color pixels[8][4],
+                            size_t hint, Color colors[2]);
+
+// Branch and bound search, evaluates the hint first
+size_t matchScalar(const MatchTable* table, Color pixels[8][4], size_t hint,
+                   Color colors[2]);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATCH_X86
+// Exhaustive search, the hint is ignored
+size_t matchSSE41(const MatchTable* table, Color pixels[8][4], size_t hint,
+                  Color colors[2]);
+size_t matchAVX2(const MatchTable* table, Color pixels[8][4], size_t hint,
+                 Color colors[2]);
+#endif
+
+// Find the closest glyph of a cell of table->words * 32 pixels, given in rows
+// from the top left, like MatchFunc
+typedef size_t (*WideMatchFunc)(const MatchTable* table, const Color* pixels,
+                                size_t hint, Color colors[2]);
+
+// Branch and bound search, evaluates the hint first
+size_t matchWideScalar(const MatchTable* table, const Color* pixels,
+                       size_t hint, Color colors[2]);
+
+#ifdef MATCH_X86
+// Exhaustive search of MATCH_WIDE_BATCH glyphs at a time, the hint is ignored
+size_t matchWideSSE41(const MatchTable* table, const Color* pixels,
+                      size_t hint, Color colors[2]);
+size_t matchWideAVX2(const MatchTable* table, const Color* pixels,
+                     size_t hint, Color colors[2]);
+#endif
+
+// Helpers shared by the matchers
+uint32_t getCellSqrSum(Color pixels[8][4]);
+void getGlyphColors(uint32_t mask, Color pixels[8][4], Color colors[2]);
+uint32_t getWideSqrSum(const Color* pixels, int count);
+void getWideGlyphColors(const MatchTable* table, size_t index,
+                        const Color* pixels, Color colors[2]);
+
+#endif
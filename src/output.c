@@ -0,0 +1,136 @@
+#include "output.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define OUTBUF_MIN_CAP 4096
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+void initOutBuf(OutBuf* buf, int fd, size_t chunk) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+    buf->fd = fd;
+    buf->chunk = chunk;
+    buf->stats = NULL;
+    buf->failed = 0;
+}
+
+void freeOutBuf(OutBuf* buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
+
+char* reserveOutBuf(OutBuf* buf, size_t n) {
+    if (buf->failed)
+        return NULL;
+    if (buf->len + n > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : OUTBUF_MIN_CAP;
+        while (cap < buf->len + n) {
+            cap *= 2;
+        }
+        char* data = realloc(buf->data, cap);
+        if (!data) {
+            buf->failed = 1;
+            return NULL;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    return buf->data + buf->len;
+}
+
+// writev until everything is written, iov is modified
+static void writeFull(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count > IOV_MAX ? IOV_MAX : count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Cannot write output");
+            exit(EXIT_FAILURE);
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// Only the command writes to file descriptors, it cannot go on without
+// memory for the output
+static void checkFailed(const OutBuf* buf) {
+    if (buf->failed) {
+        fprintf(stderr, "Cannot allocate memory for output\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void flushOutBuf(OutBuf* buf) {
+    if (buf->fd < 0)
+        return;
+    checkFailed(buf);
+    if (buf->len == 0)
+        return;
+    StageTime start;
+    startStage(buf->stats, &start);
+    if (buf->stats)
+        countOutput(buf->stats, buf->data, buf->len);
+    struct iovec iov = {.iov_base = buf->data, .iov_len = buf->len};
+    writeFull(buf->fd, &iov, 1);
+    buf->len = 0;
+    endStage(buf->stats, STAT_WRITE, &start);
+}
+
+void checkOutBuf(OutBuf* buf) {
+    if (buf->chunk && buf->len >= buf->chunk)
+        flushOutBuf(buf);
+}
+
+void flushOutBufs(OutBuf* out, OutBuf* bufs[], int count) {
+    checkFailed(out);
+    for (int i = 0; i < count; i++) {
+        checkFailed(bufs[i]);
+    }
+    StageTime start;
+    startStage(out->stats, &start);
+    struct iovec stack_iov[16];
+    struct iovec* iov = stack_iov;
+    if (count > 16) {
+        iov = malloc(sizeof(struct iovec) * count);
+        if (!iov) {
+            fprintf(stderr, "Cannot allocate memory for output\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (bufs[i]->len) {
+            iov[n].iov_base = bufs[i]->data;
+            iov[n].iov_len = bufs[i]->len;
+            n++;
+            if (out->stats)
+                countOutput(out->stats, bufs[i]->data, bufs[i]->len);
+        }
+    }
+    writeFull(out->fd, iov, n);
+    for (int i = 0; i < count; i++) {
+        bufs[i]->len = 0;
+    }
+    if (iov != stack_iov)
+        free(iov);
+    endStage(out->stats, STAT_WRITE, &start);
+}
@@ -0,0 +1,100 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "stats.h"
+
+// Growable output buffer. Escape sequences are formatted straight into it and
+// written out with a single write call per flush.
+typedef struct OutBuf {
+    char* data;
+    size_t len;
+    size_t cap;
+    // File descriptor to flush to, or -1 to only collect in memory
+    int fd;
+    // Flush once this many bytes are pending, 0 to flush only on demand
+    size_t chunk;
+    // Writes are timed and counted here if set
+    Stats* stats;
+    // Set when the buffer could not grow, the writes from then on are dropped
+    int failed;
+} OutBuf;
+
+void initOutBuf(OutBuf* buf, int fd, size_t chunk);
+void freeOutBuf(OutBuf* buf);
+
+// Make room for n more bytes and return where to write them, or NULL and set
+// failed if there is no memory
+char* reserveOutBuf(OutBuf* buf, size_t n);
+
+// Write the pending bytes to the file descriptor. Exit if the buffer failed,
+// buffers that only collect in memory are never flushed.
+void flushOutBuf(OutBuf* buf);
+// Flush if the pending bytes reached the chunk size
+void checkOutBuf(OutBuf* buf);
+
+// Write the pending bytes of several buffers to the file descriptor of out
+// with one writev, then empty them
+void flushOutBufs(OutBuf* out, OutBuf* bufs[], int count);
+
+static inline void outWrite(OutBuf* buf, const char* s, size_t n) {
+    char* p = reserveOutBuf(buf, n);
+    if (!p)
+        return;
+    memcpy(p, s, n);
+    buf->len += n;
+}
+
+static inline void outPuts(OutBuf* buf, const char* s) {
+    outWrite(buf, s, strlen(s));
+}
+
+static inline void outPutc(OutBuf* buf, char c) {
+    char* p = reserveOutBuf(buf, 1);
+    if (!p)
+        return;
+    *p = c;
+    buf->len++;
+}
+
+// UTF-8 bytes of the codepoint as a constant expression, the first byte in
+// the lowest bits. The bytes after the last one are zero.
+#define UTF8_PACK(c)                                                       \
+    ((c) < 0x80      ? (uint32_t)(c)                                       \
+     : (c) < 0x800   ? (0xc0 | (c) >> 6) | (0x80 | ((c) & 0x3f)) << 8      \
+     : (c) < 0x10000 ? (0xe0 | (c) >> 12) | (0x80 | ((c) >> 6 & 0x3f)) << 8 | \
+                           (0x80 | ((c) & 0x3f)) << 16                     \
+                     : (0xf0 | (c) >> 18) | (0x80 | ((c) >> 12 & 0x3f)) << 8 | \
+                           (0x80 | ((c) >> 6 & 0x3f)) << 16 |              \
+                           (uint32_t)(0x80 | ((c) & 0x3f)) << 24)
+
+// Write a character packed by UTF8_PACK with a single 4-byte store, then keep
+// the bytes up to the last nonzero one
+static inline void outPutUtf8(OutBuf* buf, uint32_t utf8) {
+    char* p = reserveOutBuf(buf, 4);
+    if (!p)
+        return;
+    p[0] = utf8;
+    p[1] = utf8 >> 8;
+    p[2] = utf8 >> 16;
+    p[3] = utf8 >> 24;
+    buf->len += (39 - __builtin_clz(utf8 | 1)) >> 3;
+}
+
+// Format a byte in decimal, return the end of the digits
+static inline char* formatUint8(char* p, uint8_t value) {
+    if (value >= 100) {
+        *p++ = '0' + value / 100;
+        value %= 100;
+        *p++ = '0' + value / 10;
+    } else if (value >= 10) {
+        *p++ = '0' + value / 10;
+    }
+    *p++ = '0' + value % 10;
+    return p;
+}
+
+#endif
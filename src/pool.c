@@ -0,0 +1,114 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct Task {
+    TaskFunc func;
+    void* arg;
+    struct Task* next;
+} Task;
+
+typedef struct Worker {
+    ThreadPool* pool;
+    int index;
+} Worker;
+
+struct ThreadPool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Task* head;
+    Task* tail;
+    int stop;
+    int thread_count;
+    pthread_t* threads;
+    Worker* workers;
+};
+
+static void* poolWorker(void* arg) {
+    Worker* worker = arg;
+    ThreadPool* pool = worker->pool;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->head && !pool->stop) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        Task* task = pool->head;
+        if (!task) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pool->head = task->next;
+        if (!pool->head)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->func(task->arg, worker->index);
+        free(task);
+    }
+}
+
+ThreadPool* createThreadPool(int threads) {
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    if (!pool)
+        return NULL;
+    pool->threads = malloc(sizeof(pthread_t) * threads);
+    pool->workers = malloc(sizeof(Worker) * threads);
+    if (!pool->threads || !pool->workers) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    for (int i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, poolWorker,
+                           &pool->workers[i]) != 0)
+            break;
+        pool->thread_count++;
+    }
+    if (pool->thread_count == 0) {
+        destroyThreadPool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int submitTask(ThreadPool* pool, TaskFunc func, void* arg) {
+    Task* task = malloc(sizeof(Task));
+    if (!task)
+        return -1;
+    task->func = func;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = task;
+    } else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void destroyThreadPool(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,16 @@
+#ifndef POOL_H
+#define POOL_H
+
+typedef struct ThreadPool ThreadPool;
+
+// worker is the index of the thread running the task, from 0 to threads - 1
+typedef void (*TaskFunc)(void* arg, int worker);
+
+ThreadPool* createThreadPool(int threads);
+// Queue a task, tasks are started in submission order. Return -1 if there is
+// no memory for it.
+int submitTask(ThreadPool* pool, TaskFunc func, void* arg);
+// Finish all queued tasks and join the threads
+void destroyThreadPool(ThreadPool* pool);
+
+#endif
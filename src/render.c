@@ -0,0 +1,388 @@
+#include "render.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alpha.h"
+#include "enhance.h"
+#include "stb_image_resize.h"
+
+// Bands per thread, more bands balance uneven rows better
+#define BANDS_PER_JOB 4
+// Cell rows matched and printed at a time on one thread. When resizing, a
+// band also reads the source rows its filter reaches past it, so smaller
+// bands redo more of the work.
+#define SERIAL_BAND_ROWS 8
+
+typedef struct RenderJob RenderJob;
+
+typedef struct Band {
+    RenderJob* job;
+    int row_start;
+    int row_end;
+    OutBuf out;
+    int done;
+    // Set if there was no memory to render it
+    int failed;
+} Band;
+
+struct RenderJob {
+    const uint32_t* pixels;
+    int img_w;
+    int img_h;
+    // Resized to img_w x img_h band by band instead of pixels if set
+    const uint32_t* src;
+    int src_w;
+    int src_h;
+    // Blend the resized bands over the background
+    int alpha;
+    // Fill the grid instead of printing if set
+    CellGrid* grid;
+    const RenderOptions* opts;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+void getCellSize(int enhance_level, const GlyphSet* glyphs, int* pixel_w,
+                 int* pixel_h) {
+    if (!glyphs)
+        glyphs = getDefaultGlyphSet();
+    switch (enhance_level) {
+        case 0:
+            *pixel_w = 1;
+            *pixel_h = 1;
+            break;
+        case 1:
+            *pixel_w = 1;
+            *pixel_h = 2;
+            break;
+        default:
+            *pixel_w = glyphs->cell_w;
+            *pixel_h = glyphs->cell_h;
+    }
+}
+
+void getResizeSize(const SizeOptions* opts, int img_w, int img_h, int* out_w,
+                   int* out_h) {
+    int resize_h = 0, resize_w = 0;
+    int screen_w = opts->screen_cols, screen_h = opts->screen_rows;
+
+    // For converting screen size to pixel size
+    float mul_w, mul_h;
+    switch (opts->enhance_level) {
+        case 0:
+            mul_w = 0.5f;
+            mul_h = 1.0f;
+            break;
+        case 1:
+            mul_w = 1.0f;
+            mul_h = 2.0f;
+            break;
+        default:
+            mul_w = opts->cell_w ? opts->cell_w : 4.0f;
+            mul_h = opts->cell_h ? opts->cell_h : 8.0f;
+    }
+
+    screen_w *= mul_w;
+    screen_h *= mul_h;
+
+    if (opts->target_w == -1 && opts->target_h == -1) {
+        // Both not set, use screen size
+        resize_h = screen_h * opts->screen_percentage / 100.0f;
+        resize_w = (int64_t)img_w * resize_h / img_h;
+        if (resize_w > screen_w) {
+            resize_w = screen_w;
+            resize_h = (int64_t)img_h * resize_w / img_w;
+        }
+    } else {
+        if (opts->target_w != -1) {
+            resize_w = opts->target_w ? opts->target_w * mul_w : screen_w;
+            if (opts->target_h == -1) {
+                resize_h = (int64_t)img_h * resize_w / img_w;
+            }
+        }
+        if (opts->target_h != -1) {
+            resize_h = opts->target_h ? opts->target_h * mul_h : screen_h;
+            if (opts->target_w == -1) {
+                resize_w = (int64_t)img_w * resize_h / img_h;
+            }
+        }
+    }
+
+    *out_w = resize_w;
+    *out_h = resize_h;
+}
+
+// Match the cells of the pixels into the grid, from the top row of both
+static void fillGrid(CellGrid* grid, const uint32_t* pixels, int img_w,
+                     const RenderOptions* opts, CellCache* cache) {
+    int pixel_w, pixel_h;
+    getCellSize(opts->enhance_level, opts->glyphs, &pixel_w, &pixel_h);
+    const GlyphSet* glyphs = opts->glyphs ? opts->glyphs : getDefaultGlyphSet();
+
+    for (int row = 0; row < grid->rows; row++) {
+        int x = row * pixel_h;
+        size_t hint = NO_GLYPH_HINT;
+        size_t cell = (size_t)row * grid->cols;
+        for (int y = 0; y + pixel_w <= img_w; y += pixel_w, cell++) {
+            switch (opts->enhance_level) {
+                case 0:
+                    grid->glyphs[cell] = UTF8_PACK(' ');
+                    grid->bg[cell] = pixels[x * img_w + y] & 0xffffff;
+                    grid->fg[cell] = 0;
+                    break;
+                case 1:
+                    grid->glyphs[cell] = UTF8_PACK(0x2584);
+                    grid->bg[cell] = pixels[x * img_w + y] & 0xffffff;
+                    grid->fg[cell] = pixels[(x + 1) * img_w + y] & 0xffffff;
+                    break;
+                default: {
+                    // Pixels of the cell in rows from the top left
+                    Color block[MATCH_MAX_PIXELS];
+                    for (int x1 = 0; x1 < pixel_h; x1++) {
+                        for (int y1 = 0; y1 < pixel_w; y1++) {
+                            block[x1 * pixel_w + y1].color =
+                                pixels[(x + x1) * img_w + (y + y1)];
+                        }
+                    }
+                    Color colors[2];
+                    size_t index =
+                        glyphs->table.words > 1
+                            ? findClosestWideShape(glyphs, &hint, block,
+                                                   colors)
+                            : findClosestShape(glyphs, cache, &hint,
+                                               (Color(*)[4])block, colors);
+                    grid->glyphs[cell] = glyphs->utf8[index];
+                    grid->bg[cell] = colors[0].color & 0xffffff;
+                    grid->fg[cell] = colors[1].color & 0xffffff;
+                }
+            }
+        }
+    }
+}
+
+// Match the cell rows in [row_start, row_end), resizing them from the source
+// first if the job has one. Fill them into the grid of the job if it has one,
+// print them otherwise. Return -1 if there is no memory for them.
+static int renderJobRows(OutBuf* out, const RenderJob* job, CellCache* cache,
+                          int row_start, int row_end) {
+    const RenderOptions* opts = job->opts;
+    int pixel_w, pixel_h;
+    getCellSize(opts->enhance_level, opts->glyphs, &pixel_w, &pixel_h);
+    int count = row_end - row_start;
+    int band_h = count * pixel_h;
+
+    const uint32_t* pixels;
+    uint32_t* scaled = NULL;
+    if (job->src) {
+        scaled = malloc(sizeof(uint32_t) * job->img_w * band_h);
+        if (!scaled)
+            return -1;
+        // Same filter and scale as stbir_resize_uint8 of the whole image,
+        // only shifted down to the band
+        int resized = stbir_resize_subpixel(
+            job->src, job->src_w, job->src_h, sizeof(uint32_t) * job->src_w,
+            scaled, job->img_w, band_h, sizeof(uint32_t) * job->img_w,
+            STBIR_TYPE_UINT8, 4, -1, 0, STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP,
+            STBIR_FILTER_DEFAULT, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR,
+            NULL, (float)job->img_w / job->src_w,
+            (float)job->img_h / job->src_h, 0, row_start * pixel_h);
+        if (!resized) {
+            free(scaled);
+            return -1;
+        }
+        // Blended while the band is still in the cache
+        if (job->alpha)
+            blendAlpha(scaled, job->img_w, band_h, opts->background);
+        pixels = scaled;
+    } else {
+        pixels = job->pixels + (size_t)row_start * pixel_h * job->img_w;
+    }
+
+    CellGrid grid;
+    if (job->grid) {
+        getGridRows(job->grid, row_start, count, &grid);
+    } else if (initRenderGrid(&grid, job->img_w, band_h, opts) != 0) {
+        free(scaled);
+        return -1;
+    }
+    fillGrid(&grid, pixels, job->img_w, opts, cache);
+    free(scaled);
+    if (job->grid)
+        return 0;
+
+    for (int row = 0; row < count; row++) {
+        printCellRow(out, &grid, row, opts->color_mode);
+        outPutc(out, '\n');
+        checkOutBuf(out);
+    }
+    freeCellGrid(&grid);
+    return 0;
+}
+
+static void renderBand(void* arg, int worker) {
+    Band* band = arg;
+    RenderJob* job = band->job;
+    const RenderOptions* opts = job->opts;
+    CellCache* cache = opts->caches ? &opts->caches[worker] : NULL;
+    if (!job->grid)
+        initOutBuf(&band->out, -1, 0);
+    int ret =
+        renderJobRows(&band->out, job, cache, band->row_start, band->row_end);
+
+    pthread_mutex_lock(&job->lock);
+    band->failed = ret != 0 || band->out.failed;
+    band->done = 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Write the bands in row order as soon as each one is ready, together with
+// any following bands that are already done. ready holds band_count buffers.
+// A band that failed fails out.
+static void flushBands(OutBuf* out, RenderJob* job, Band* bands,
+                       int band_count, OutBuf** ready) {
+    flushOutBuf(out);
+    for (int i = 0; i < band_count;) {
+        int count = 0;
+        pthread_mutex_lock(&job->lock);
+        while (!bands[i].done) {
+            pthread_cond_wait(&job->cond, &job->lock);
+        }
+        while (i + count < band_count && bands[i + count].done) {
+            if (bands[i + count].failed)
+                out->failed = 1;
+            ready[count] = &bands[i + count].out;
+            count++;
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (out->fd < 0) {
+            for (int j = 0; j < count; j++) {
+                outWrite(out, ready[j]->data, ready[j]->len);
+            }
+        } else {
+            flushOutBufs(out, ready, count);
+        }
+        for (int j = 0; j < count; j++) {
+            freeOutBuf(ready[j]);
+        }
+        i += count;
+    }
+}
+
+// Print the job to out, or fill its grid. Return -1 if there was no memory
+// for all of it.
+static int renderJob(OutBuf* out, RenderJob* job) {
+    const RenderOptions* opts = job->opts;
+    int pixel_w, pixel_h;
+    getCellSize(opts->enhance_level, opts->glyphs, &pixel_w, &pixel_h);
+    int rows = job->img_h / pixel_h;
+
+    if (!opts->pool || opts->jobs <= 1 || rows <= 1) {
+        CellCache* cache = opts->caches ? &opts->caches[0] : NULL;
+        for (int row = 0; row < rows; row += SERIAL_BAND_ROWS) {
+            int end = row + SERIAL_BAND_ROWS;
+            if (end > rows)
+                end = rows;
+            if (renderJobRows(out, job, cache, row, end) != 0)
+                return -1;
+        }
+        return out && out->failed ? -1 : 0;
+    }
+
+    int band_count = opts->jobs * BANDS_PER_JOB;
+    if (band_count > rows)
+        band_count = rows;
+    Band* bands = calloc(band_count, sizeof(Band));
+    OutBuf** ready = malloc(sizeof(OutBuf*) * band_count);
+    if (!bands || !ready) {
+        free(bands);
+        free(ready);
+        return -1;
+    }
+
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->cond, NULL);
+
+    for (int i = 0; i < band_count; i++) {
+        bands[i].job = job;
+        bands[i].row_start = rows * i / band_count;
+        bands[i].row_end = rows * (i + 1) / band_count;
+    }
+    for (int i = 0; i < band_count; i++) {
+        if (submitTask(opts->pool, renderBand, &bands[i]) != 0) {
+            // The rest are never started
+            pthread_mutex_lock(&job->lock);
+            for (int j = i; j < band_count; j++) {
+                initOutBuf(&bands[j].out, -1, 0);
+                bands[j].done = bands[j].failed = 1;
+            }
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+    }
+
+    int failed = 0;
+    if (job->grid) {
+        pthread_mutex_lock(&job->lock);
+        for (int i = 0; i < band_count; i++) {
+            while (!bands[i].done) {
+                pthread_cond_wait(&job->cond, &job->lock);
+            }
+            failed |= bands[i].failed;
+        }
+        pthread_mutex_unlock(&job->lock);
+    } else {
+        flushBands(out, job, bands, band_count, ready);
+        failed = out->failed;
+    }
+
+    pthread_cond_destroy(&job->cond);
+    pthread_mutex_destroy(&job->lock);
+    free(ready);
+    free(bands);
+    return failed ? -1 : 0;
+}
+
+int renderImage(OutBuf* out, const uint32_t* pixels, int img_w, int img_h,
+                const RenderOptions* opts) {
+    RenderJob job = {
+        .pixels = pixels, .img_w = img_w, .img_h = img_h, .opts = opts};
+    return renderJob(out, &job);
+}
+
+int renderScaledImage(OutBuf* out, const uint32_t* src, int src_w, int src_h,
+                      int img_w, int img_h, int alpha,
+                      const RenderOptions* opts) {
+    RenderJob job = {.img_w = img_w,
+                     .img_h = img_h,
+                     .src = src,
+                     .src_w = src_w,
+                     .src_h = src_h,
+                     .alpha = alpha,
+                     .opts = opts};
+    return renderJob(out, &job);
+}
+
+int initRenderGrid(CellGrid* grid, int img_w, int img_h,
+                   const RenderOptions* opts) {
+    int pixel_w, pixel_h;
+    getCellSize(opts->enhance_level, opts->glyphs, &pixel_w, &pixel_h);
+    // A space is half as wide as the other glyphs, two make a cell
+    int width = opts->enhance_level == 0 ? 2 : 1;
+    return initCellGrid(grid, img_w / pixel_w, img_h / pixel_h, width);
+}
+
+int renderGrid(CellGrid* grid, const uint32_t* pixels, int img_w,
+               const RenderOptions* opts) {
+    int pixel_w, pixel_h;
+    getCellSize(opts->enhance_level, opts->glyphs, &pixel_w, &pixel_h);
+    RenderJob job = {.pixels = pixels,
+                     .img_w = img_w,
+                     .img_h = grid->rows * pixel_h,
+                     .grid = grid,
+                     .opts = opts};
+    return renderJob(NULL, &job);
+}
@@ -0,0 +1,72 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdint.h>
+
+#include "cellcache.h"
+#include "color.h"
+#include "glyphs.h"
+#include "grid.h"
+#include "output.h"
+#include "pool.h"
+
+typedef struct RenderOptions {
+    int enhance_level;
+    ColorMode color_mode;
+    // Match bands of cell rows on the pool if set
+    ThreadPool* pool;
+    int jobs;
+    // Matched cell caches, one per job, or NULL
+    CellCache* caches;
+    // Transparent pixels are blended over this color
+    Color background;
+    // Glyphs to match at enhance level 2, NULL for the default set
+    const GlyphSet* glyphs;
+} RenderOptions;
+
+// Target size, as set with -w, -h and -p
+typedef struct SizeOptions {
+    // -1 if not set
+    int target_w;
+    int target_h;
+    int screen_percentage;
+    int enhance_level;
+    // Pixels per cell of the glyph set at enhance level 2, 0 for 4x8
+    int cell_w;
+    int cell_h;
+    // Terminal size in cells
+    int screen_cols;
+    int screen_rows;
+} SizeOptions;
+
+// Pixels per cell at the enhance level, with the glyph set or the default one
+// if NULL
+void getCellSize(int enhance_level, const GlyphSet* glyphs, int* pixel_w,
+                 int* pixel_h);
+
+// Pixel size to resize an image to
+void getResizeSize(const SizeOptions* opts, int img_w, int img_h, int* out_w,
+                   int* out_h);
+
+// Print the image, one line per cell row. Return -1 if there was no memory to
+// render all of it, out may then hold part of it.
+int renderImage(OutBuf* out, const uint32_t* pixels, int img_w, int img_h,
+                const RenderOptions* opts);
+
+// Resize the image of src_w x src_h to img_w x img_h and print it, a band of
+// cell rows at a time. If alpha is set, the bands are blended over the
+// background. Gives the same output as renderImage of the resized and blended
+// image, without holding all of it. Return -1 as renderImage.
+int renderScaledImage(OutBuf* out, const uint32_t* src, int src_w, int src_h,
+                      int img_w, int img_h, int alpha,
+                      const RenderOptions* opts);
+
+// Size the grid for an image of the size
+int initRenderGrid(CellGrid* grid, int img_w, int img_h,
+                   const RenderOptions* opts);
+// Match the cells of the image into the grid, without printing. Return -1 if
+// there was no memory to match all of them.
+int renderGrid(CellGrid* grid, const uint32_t* pixels, int img_w,
+               const RenderOptions* opts);
+
+#endif
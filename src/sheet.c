@@ -0,0 +1,189 @@
+#include "sheet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grid.h"
+
+// Columns between tiles
+#define TILE_GAP 1
+
+typedef struct Tile {
+    CellGrid grid;
+    const char* file_path;
+} Tile;
+
+void initSheetOptions(SheetOptions* opts, int columns,
+                      const SizeOptions* size) {
+    opts->columns = columns;
+    opts->tile_w = size->target_w > 0
+                       ? size->target_w
+                       : (size->screen_cols - TILE_GAP * (columns - 1)) /
+                             columns;
+    // Two columns for a pixel at enhance level 0
+    if (opts->tile_w < 2)
+        opts->tile_w = 2;
+    opts->tile_h = size->target_h > 0 ? size->target_h : opts->tile_w / 2;
+}
+
+void getTileSizeOptions(const SheetOptions* opts, const SizeOptions* screen,
+                        SizeOptions* size) {
+    size->target_w = -1;
+    size->target_h = -1;
+    size->screen_percentage = 100;
+    size->enhance_level = screen->enhance_level;
+    size->cell_w = screen->cell_w;
+    size->cell_h = screen->cell_h;
+    size->screen_cols = opts->tile_w;
+    size->screen_rows = opts->tile_h;
+}
+
+static void outPutSpaces(OutBuf* out, int n) {
+    char* p = n > 0 ? reserveOutBuf(out, n) : NULL;
+    if (!p)
+        return;
+    memset(p, ' ', n);
+    out->len += n;
+}
+
+// Length of the UTF-8 sequence at p, 0 if it is not valid
+static int getUtf8Length(const unsigned char* p) {
+    int len = *p < 0x80   ? 1
+              : *p < 0xc2 ? 0
+              : *p < 0xe0 ? 2
+              : *p < 0xf0 ? 3
+              : *p < 0xf5 ? 4
+                          : 0;
+    for (int i = 1; i < len; i++) {
+        if ((p[i] & 0xc0) != 0x80)
+            return 0;
+    }
+    return len;
+}
+
+// Base name cut to the width. Names are UTF-8 and each code point is one
+// column. Controls and invalid bytes are written as '?', so a name cannot
+// send escape sequences to the terminal.
+static void printLabel(OutBuf* out, const char* file_path, int width) {
+    const char* name = strrchr(file_path, '/');
+    name = name && name[1] ? name + 1 : file_path;
+    const unsigned char* p = (const unsigned char*)name;
+    int cols = 0;
+    for (; *p && cols < width; cols++) {
+        int len = getUtf8Length(p);
+        // C0 and DEL, or C1 as U+0080 to U+009F
+        int control = (len == 1 && (*p < 0x20 || *p == 0x7f)) ||
+                      (len == 2 && *p == 0xc2 && p[1] < 0xa0);
+        if (len == 0 || control) {
+            outPutc(out, '?');
+            p += len ? len : 1;
+        } else {
+            outWrite(out, (const char*)p, len);
+            p += len;
+        }
+    }
+    outPutSpaces(out, width - cols);
+}
+
+static void printTiles(OutBuf* out, Tile* tiles, int count,
+                       const SheetOptions* opts, ColorMode mode) {
+    int rows = 0;
+    for (int i = 0; i < count; i++) {
+        if (tiles[i].grid.rows > rows)
+            rows = tiles[i].grid.rows;
+    }
+
+    // The last row is the file names
+    for (int row = 0; row <= rows; row++) {
+        for (int i = 0; i < count; i++) {
+            const CellGrid* grid = &tiles[i].grid;
+            if (i > 0)
+                outPutSpaces(out, TILE_GAP);
+            if (row == rows) {
+                printLabel(out, tiles[i].file_path, opts->tile_w);
+                continue;
+            }
+            // Centered in the tile
+            int width = grid->cols * grid->width;
+            int left = (opts->tile_w - width) / 2;
+            if (row < grid->rows) {
+                outPutSpaces(out, left);
+                printCellRow(out, grid, row, mode);
+                outPutSpaces(out, opts->tile_w - width - left);
+            } else {
+                outPutSpaces(out, opts->tile_w);
+            }
+        }
+        outPutc(out, '\n');
+    }
+}
+
+void showSheet(OutBuf* out, ImageQueue* queue, const SheetOptions* opts,
+               const RenderOptions* render_opts, Stats* stats) {
+    Tile* tiles = calloc(opts->columns, sizeof(Tile));
+    if (!tiles) {
+        fprintf(stderr, "Cannot allocate memory for tiles\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int count = 0;
+    LoadedImage* image;
+    StageTime start;
+    for (;;) {
+        image = nextImage(queue);
+        if (image && image->status != 0) {
+            fprintf(stderr, "Cannot open file %s\n", image->file_path);
+            continue;
+        }
+
+        if (image) {
+            if (stats) {
+                for (int i = 0; i < STAT_RENDER; i++) {
+                    stats->stages[i].wall += image->stats.stages[i].wall;
+                    stats->stages[i].cpu += image->stats.stages[i].cpu;
+                }
+            }
+            Tile* tile = &tiles[count++];
+            tile->file_path = image->file_path;
+            startStage(stats, &start);
+            if (initRenderGrid(&tile->grid, image->w, image->h,
+                               render_opts) != 0) {
+                fprintf(stderr, "Cannot allocate memory for tiles\n");
+                exit(EXIT_FAILURE);
+            }
+            if (renderGrid(&tile->grid, image->pixels, image->w,
+                           render_opts) != 0) {
+                fprintf(stderr, "Cannot allocate memory for render\n");
+                exit(EXIT_FAILURE);
+            }
+            endStage(stats, STAT_RENDER, &start);
+            if (stats)
+                stats->cells += (uint64_t)tile->grid.cols * tile->grid.rows;
+        }
+
+        if (count == opts->columns || (!image && count > 0)) {
+            // Writes are timed on their own
+            StageTime write_start = {0, 0};
+            if (stats)
+                write_start = stats->stages[STAT_WRITE];
+            startStage(stats, &start);
+            printTiles(out, tiles, count, opts, render_opts->color_mode);
+            flushOutBuf(out);
+            endStage(stats, STAT_RENDER, &start);
+            if (stats) {
+                StageTime* render = &stats->stages[STAT_RENDER];
+                StageTime* write = &stats->stages[STAT_WRITE];
+                render->wall -= write->wall - write_start.wall;
+                render->cpu -= write->cpu - write_start.cpu;
+            }
+            for (int i = 0; i < count; i++) {
+                freeCellGrid(&tiles[i].grid);
+            }
+            count = 0;
+        }
+        if (!image)
+            break;
+    }
+    free(tiles);
+}
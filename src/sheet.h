@@ -0,0 +1,32 @@
+#ifndef SHEET_H
+#define SHEET_H
+
+#include "batch.h"
+#include "output.h"
+#include "render.h"
+#include "stats.h"
+
+typedef struct SheetOptions {
+    // Tiles per row
+    int columns;
+    // Terminal columns and rows of a tile, images are fit inside
+    int tile_w;
+    int tile_h;
+} SheetOptions;
+
+// Tiles of target_w x target_h terminal cells of size if set. Otherwise as
+// wide as the columns fit on the screen, and half as many rows as columns,
+// which is about square.
+void initSheetOptions(SheetOptions* opts, int columns, const SizeOptions* size);
+// Size to load the images of the sheet at, with the enhance level and cell size
+// of screen
+void getTileSizeOptions(const SheetOptions* opts, const SizeOptions* screen,
+                        SizeOptions* size);
+
+// Show the images of the queue as rows of tiles with the file names below
+// them. Each row of tiles is matched tile by tile, then printed with one write.
+// Files that cannot be opened are reported and left out.
+void showSheet(OutBuf* out, ImageQueue* queue, const SheetOptions* opts,
+               const RenderOptions* render_opts, Stats* stats);
+
+#endif
@@ -0,0 +1,131 @@
+#include "stats.h"
+
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static const char* stage_names[STAT_COUNT] = {"decode", "resize", "alpha",
+                                               "render", "write"};
+
+static double getClock(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+StageTime getStageTime(void) {
+    StageTime t = {.wall = getClock(CLOCK_MONOTONIC),
+                   .cpu = getClock(CLOCK_PROCESS_CPUTIME_ID)};
+    return t;
+}
+
+void startStage(Stats* stats, StageTime* start) {
+    if (stats)
+        *start = getStageTime();
+}
+
+void endStage(Stats* stats, StatStage stage, const StageTime* start) {
+    if (!stats)
+        return;
+    StageTime now = getStageTime();
+    stats->stages[stage].wall += now.wall - start->wall;
+    stats->stages[stage].cpu += now.cpu - start->cpu;
+}
+
+void countOutput(Stats* stats, const char* data, size_t len) {
+    stats->bytes += len;
+    const char* end = data + len;
+    while ((data = memchr(data, '\x1b', end - data))) {
+        stats->escapes++;
+        data++;
+    }
+}
+
+// Peak resident set size in KiB
+static long getPeakMemory(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_maxrss;
+}
+
+static void printJsonString(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+void printStats(FILE* f, const Stats* stats, const char* file_path,
+                StatsFormat format) {
+    double wall = 0, cpu = 0;
+    for (int i = 0; i < STAT_COUNT; i++) {
+        wall += stats->stages[i].wall;
+        cpu += stats->stages[i].cpu;
+    }
+    long peak = getPeakMemory();
+
+    if (format == STATS_JSON) {
+        fprintf(f, "{\"file\":");
+        printJsonString(f, file_path);
+        fprintf(f, ",\"stages\":{");
+        for (int i = 0; i < STAT_COUNT; i++) {
+            fprintf(f, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}",
+                    i ? "," : "", stage_names[i],
+                    stats->stages[i].wall * 1e3, stats->stages[i].cpu * 1e3);
+        }
+        fprintf(f,
+                "},\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"peak_kib\":%ld,"
+                "\"cells\":%llu,\"bytes\":%llu,\"escapes\":%llu",
+                wall * 1e3, cpu * 1e3, peak,
+                (unsigned long long)stats->cells,
+                (unsigned long long)stats->bytes,
+                (unsigned long long)stats->escapes);
+        if (stats->frames) {
+            fprintf(f,
+                    ",\"frames\":%llu,\"dropped\":%llu,\"latency_ms\":%.3f,"
+                    "\"max_latency_ms\":%.3f",
+                    (unsigned long long)stats->frames,
+                    (unsigned long long)stats->dropped,
+                    stats->latency / stats->frames * 1e3,
+                    stats->max_latency * 1e3);
+        }
+        fprintf(f, "}\n");
+        return;
+    }
+
+    fprintf(f, "%s\n", file_path);
+    fprintf(f, "    %-8s %10s %10s\n", "stage", "wall ms", "cpu ms");
+    for (int i = 0; i < STAT_COUNT; i++) {
+        fprintf(f, "    %-8s %10.3f %10.3f\n", stage_names[i],
+                stats->stages[i].wall * 1e3, stats->stages[i].cpu * 1e3);
+    }
+    fprintf(f, "    %-8s %10.3f %10.3f\n", "total", wall * 1e3, cpu * 1e3);
+    fprintf(f, "    peak memory %ld KiB\n", peak);
+    fprintf(f, "    %llu cells, %llu bytes, %llu escapes\n",
+            (unsigned long long)stats->cells,
+            (unsigned long long)stats->bytes,
+            (unsigned long long)stats->escapes);
+    if (stats->cells) {
+        fprintf(f, "    %.2f bytes per cell, %.0f cells per second\n",
+                (double)stats->bytes / stats->cells,
+                wall > 0 ? stats->cells / wall : 0);
+    }
+    if (stats->frames) {
+        fprintf(f, "    %llu frames, %llu dropped\n",
+                (unsigned long long)stats->frames,
+                (unsigned long long)stats->dropped);
+        fprintf(f, "    latency %.3f ms average, %.3f ms max\n",
+                stats->latency / stats->frames * 1e3,
+                stats->max_latency * 1e3);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum StatStage {
+    STAT_DECODE,
+    STAT_RESIZE,
+    STAT_ALPHA,
+    // Glyph matching and escape formatting, and resizing when it is done in
+    // bands while rendering
+    STAT_RENDER,
+    // Terminal writes
+    STAT_WRITE,
+    STAT_COUNT,
+} StatStage;
+
+// Wall and CPU seconds, the CPU time is of all threads of the process
+typedef struct StageTime {
+    double wall;
+    double cpu;
+} StageTime;
+
+// Counters of one rendered file
+typedef struct Stats {
+    StageTime stages[STAT_COUNT];
+    uint64_t cells;
+    uint64_t bytes;
+    uint64_t escapes;
+    // Streams only, seconds from reading a frame to writing it out
+    uint64_t frames;
+    uint64_t dropped;
+    double latency;
+    double max_latency;
+} Stats;
+
+typedef enum StatsFormat {
+    STATS_TEXT,
+    STATS_JSON,
+} StatsFormat;
+
+// Current monotonic time
+StageTime getStageTime(void);
+
+// Does nothing if stats is NULL
+void startStage(Stats* stats, StageTime* start);
+// Add the time since startStage to the stage
+void endStage(Stats* stats, StatStage stage, const StageTime* start);
+
+// Count the bytes and escape sequences of output about to be written
+void countOutput(Stats* stats, const char* data, size_t len);
+
+// Print the stats of the file, with the peak memory of the process so far
+void printStats(FILE* f, const Stats* stats, const char* file_path,
+                StatsFormat format);
+
+#endif
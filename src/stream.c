@@ -0,0 +1,400 @@
+#include "stream.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "anim.h"
+
+#define Y4M_MAX_LINE 1024
+#define DEFAULT_STREAM_FPS 30
+
+// Read until n bytes or the end of the file, return the bytes read or -1
+static ssize_t readFull(int fd, void* buf, size_t n) {
+    size_t len = 0;
+    while (len < n) {
+        ssize_t r = read(fd, (char*)buf + len, n - len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (r == 0)
+            break;
+        len += r;
+    }
+    return len;
+}
+
+// Read n bytes as readFull, the ones read ahead by readLine first
+static ssize_t readStream(Stream* stream, void* buf, size_t n) {
+    size_t len = stream->buf_len - stream->buf_pos;
+    if (len > n)
+        len = n;
+    memcpy(buf, stream->buf + stream->buf_pos, len);
+    stream->buf_pos += len;
+    if (len == n)
+        return len;
+    ssize_t r = readFull(stream->fd, (char*)buf + len, n - len);
+    if (r < 0)
+        return -1;
+    return len + r;
+}
+
+// Read a line without the newline, return its length or -1. Reads ahead into
+// the buffer of the stream.
+static int readLine(Stream* stream, char* line, int cap) {
+    int len = 0;
+    for (;;) {
+        if (stream->buf_pos == stream->buf_len) {
+            ssize_t r = read(stream->fd, stream->buf, sizeof(stream->buf));
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return len ? -1 : r == 0 ? 0 : -1;
+            stream->buf_pos = 0;
+            stream->buf_len = r;
+        }
+        const char* start = stream->buf + stream->buf_pos;
+        size_t avail = stream->buf_len - stream->buf_pos;
+        const char* eol = memchr(start, '\n', avail);
+        size_t n = eol ? (size_t)(eol - start) : avail;
+        if (n > (size_t)(cap - 1 - len))
+            return -1;
+        memcpy(line + len, start, n);
+        len += n;
+        stream->buf_pos += eol ? n + 1 : n;
+        if (eol)
+            break;
+    }
+    line[len] = '\0';
+    return len;
+}
+
+int parseStreamFormat(const char* s, StreamFormat* format, int* width,
+                      int* height) {
+    if (strcmp(s, "y4m") == 0) {
+        *format = STREAM_Y4M;
+        return 0;
+    }
+    char end;
+    if (sscanf(s, "rgba:%dx%d%c", width, height, &end) == 2 && *width > 0 &&
+        *height > 0) {
+        *format = STREAM_RGBA;
+        return 0;
+    }
+    return -1;
+}
+
+static int parseY4MHeader(Stream* stream, char* line) {
+    if (strncmp(line, "YUV4MPEG2", 9) != 0) {
+        fprintf(stderr, "Stream is not YUV4MPEG2\n");
+        return -1;
+    }
+    // 4:2:0 if not given
+    int sub_x = 1, sub_y = 1;
+    char* save;
+    for (char* tok = strtok_r(line + 9, " ", &save); tok;
+         tok = strtok_r(NULL, " ", &save)) {
+        switch (tok[0]) {
+            case 'W':
+                stream->width = atoi(tok + 1);
+                break;
+            case 'H':
+                stream->height = atoi(tok + 1);
+                break;
+            case 'F':
+                if (sscanf(tok + 1, "%d:%d", &stream->fps_num,
+                           &stream->fps_den) != 2) {
+                    stream->fps_num = stream->fps_den = 0;
+                }
+                break;
+            case 'C':
+                if (strcmp(tok + 1, "420") == 0 ||
+                    strcmp(tok + 1, "420jpeg") == 0 ||
+                    strcmp(tok + 1, "420paldv") == 0 ||
+                    strcmp(tok + 1, "420mpeg2") == 0) {
+                    sub_x = sub_y = 1;
+                } else if (strcmp(tok + 1, "422") == 0) {
+                    sub_x = 1;
+                    sub_y = 0;
+                } else if (strcmp(tok + 1, "444") == 0) {
+                    sub_x = sub_y = 0;
+                } else if (strcmp(tok + 1, "mono") == 0) {
+                    sub_x = sub_y = -1;
+                } else {
+                    fprintf(stderr, "Unsupported Y4M color space %s\n",
+                            tok + 1);
+                    return -1;
+                }
+                break;
+            case 'X':
+                if (strcmp(tok, "XCOLORRANGE=FULL") == 0)
+                    stream->full_range = 1;
+                break;
+        }
+    }
+    if (stream->width <= 0 || stream->height <= 0) {
+        fprintf(stderr, "Invalid Y4M frame size\n");
+        return -1;
+    }
+    if (sub_x < 0) {
+        stream->chroma_w = stream->chroma_h = 0;
+    } else {
+        stream->chroma_w = (stream->width + sub_x) >> sub_x;
+        stream->chroma_h = (stream->height + sub_y) >> sub_y;
+    }
+    return 0;
+}
+
+int openStream(Stream* stream, int fd, StreamFormat format, int width,
+               int height) {
+    memset(stream, 0, sizeof(*stream));
+    stream->fd = fd;
+    stream->format = format;
+    if (format == STREAM_RGBA) {
+        stream->width = width;
+        stream->height = height;
+        return 0;
+    }
+
+    char line[Y4M_MAX_LINE];
+    if (readLine(stream, line, sizeof(line)) <= 0) {
+        fprintf(stderr, "Cannot read Y4M header\n");
+        return -1;
+    }
+    if (parseY4MHeader(stream, line) != 0)
+        return -1;
+    stream->plane_size = (size_t)stream->width * stream->height +
+                         (size_t)stream->chroma_w * stream->chroma_h * 2;
+    stream->planes = malloc(stream->plane_size);
+    if (!stream->planes) {
+        fprintf(stderr, "Cannot allocate memory for stream\n");
+        return -1;
+    }
+    return 0;
+}
+
+void closeStream(Stream* stream) {
+    free(stream->planes);
+    stream->planes = NULL;
+}
+
+static inline uint8_t clampByte(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// BT.601, 16.16 fixed point
+static void convertYUV(const Stream* stream, uint32_t* frame) {
+    int w = stream->width, h = stream->height;
+    int cw = stream->chroma_w, ch = stream->chroma_h;
+    const uint8_t* y_plane = stream->planes;
+    const uint8_t* u_plane = y_plane + (size_t)w * h;
+    const uint8_t* v_plane = u_plane + (size_t)cw * ch;
+    // Limited range maps 16..235 and 16..240 to 0..255
+    int y_off = stream->full_range ? 0 : 16;
+    int y_mul = stream->full_range ? 65536 : 76309;
+    int rv = stream->full_range ? 91881 : 104597;
+    int gu = stream->full_range ? 22554 : 25675;
+    int gv = stream->full_range ? 46802 : 53279;
+    int bu = stream->full_range ? 116130 : 132201;
+
+    for (int y = 0; y < h; y++) {
+        const uint8_t* u_row = u_plane + (size_t)(y * ch / h) * cw;
+        const uint8_t* v_row = v_plane + (size_t)(y * ch / h) * cw;
+        for (int x = 0; x < w; x++) {
+            int luma = (y_plane[(size_t)y * w + x] - y_off) * y_mul + 32768;
+            int u = 0, v = 0;
+            if (cw) {
+                u = u_row[x * cw / w] - 128;
+                v = v_row[x * cw / w] - 128;
+            }
+            Color c = {.r = clampByte((luma + rv * v) >> 16),
+                       .g = clampByte((luma - gu * u - gv * v) >> 16),
+                       .b = clampByte((luma + bu * u) >> 16),
+                       .a = 255};
+            frame[(size_t)y * w + x] = c.color;
+        }
+    }
+}
+
+int readStreamFrame(Stream* stream, uint32_t* frame) {
+    if (stream->format == STREAM_RGBA) {
+        size_t size = sizeof(uint32_t) * stream->width * stream->height;
+        ssize_t n = readStream(stream, frame, size);
+        if (n < 0) {
+            perror("Cannot read stream");
+            return -1;
+        }
+        // A partial frame at the end is dropped
+        return (size_t)n < size;
+    }
+
+    char line[Y4M_MAX_LINE];
+    int len = readLine(stream, line, sizeof(line));
+    if (len == 0)
+        return 1;
+    if (len < 0 || strncmp(line, "FRAME", 5) != 0) {
+        fprintf(stderr, "Invalid Y4M frame header\n");
+        return -1;
+    }
+    ssize_t n = readStream(stream, stream->planes, stream->plane_size);
+    if (n < 0) {
+        perror("Cannot read stream");
+        return -1;
+    }
+    if ((size_t)n < stream->plane_size)
+        return 1;
+    convertYUV(stream, frame);
+    return 0;
+}
+
+// Frames are read on their own thread into three slots: the one being read,
+// the next complete one and the one being shown. The reader waits while the
+// complete one has not been taken, so a stream that comes faster than it is
+// shown is held back rather than skipped through.
+typedef struct FrameQueue {
+    Stream* stream;
+    uint32_t* slots[3];
+    double arrival[3];
+    int reading;
+    // -1 if no frame is waiting
+    int ready;
+    int shown;
+    // 1 at the end of the stream, -1 on errors
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} FrameQueue;
+
+static void* readFrames(void* arg) {
+    FrameQueue* queue = arg;
+    for (;;) {
+        int ret = readStreamFrame(queue->stream, queue->slots[queue->reading]);
+
+        pthread_mutex_lock(&queue->lock);
+        if (ret != 0) {
+            queue->done = ret;
+            pthread_cond_broadcast(&queue->cond);
+            pthread_mutex_unlock(&queue->lock);
+            return NULL;
+        }
+        int slot = queue->reading;
+        while (queue->ready >= 0) {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        }
+        // The slot that is neither being read nor shown
+        queue->reading = 3 - slot - queue->shown;
+        queue->ready = slot;
+        queue->arrival[slot] = getStageTime().wall;
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+static void sleepUntil(double t) {
+    struct timespec ts = {.tv_sec = (time_t)t,
+                          .tv_nsec = (long)((t - (time_t)t) * 1e9)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR) {
+    }
+}
+
+int playStream(OutBuf* out, Stream* stream, double fps, int resize_w,
+               int resize_h, const RenderOptions* opts, Stats* stats) {
+    // Frames are due at the rate of the stream, and shown at most at fps
+    double rate = DEFAULT_STREAM_FPS;
+    if (stream->fps_num > 0 && stream->fps_den > 0) {
+        rate = (double)stream->fps_num / stream->fps_den;
+    } else if (fps > 0) {
+        rate = fps;
+    }
+    double period = 1 / rate;
+    double min_gap = fps > 0 ? 1 / fps : 0;
+
+    FrameQueue queue = {.stream = stream, .reading = 0, .ready = -1,
+                        .shown = 2};
+    size_t frame_size = sizeof(uint32_t) * stream->width * stream->height;
+    for (int i = 0; i < 3; i++) {
+        queue.slots[i] = malloc(frame_size);
+        if (!queue.slots[i]) {
+            fprintf(stderr, "Cannot allocate memory for stream\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.cond, NULL);
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, readFrames, &queue) != 0) {
+        fprintf(stderr, "Cannot create stream reader thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    FramePlayer player;
+    initFramePlayer(&player, out, stream->width, stream->height, resize_w,
+                    resize_h, opts, stats);
+
+    // Time the next frame is due, and the earliest one may be shown after the
+    // last shown one
+    double due = getStageTime().wall;
+    double next_show = 0;
+    uint64_t dropped = 0;
+    for (;;) {
+        double start = getStageTime().wall;
+        pthread_mutex_lock(&queue.lock);
+        while (queue.ready < 0 && !queue.done) {
+            pthread_cond_wait(&queue.cond, &queue.lock);
+        }
+        if (queue.ready < 0) {
+            pthread_mutex_unlock(&queue.lock);
+            break;
+        }
+        int slot = queue.ready;
+        queue.ready = -1;
+        queue.shown = slot;
+        double arrival = queue.arrival[slot];
+        pthread_cond_broadcast(&queue.cond);
+        pthread_mutex_unlock(&queue.lock);
+
+        // A stream that is slower than its rate moves the times along, only
+        // falling behind in showing the frames makes them late. Frames that
+        // are read quickly while catching up do not count as slow. A frame
+        // is dropped once the next one is due, or to keep to fps.
+        double now = getStageTime().wall;
+        int behind = start >= due + period;
+        if ((!behind || now - start >= period / 2) && due < now)
+            due = now;
+        if (now >= due + period || due + period / 2 < next_show) {
+            dropped++;
+            due += period;
+            continue;
+        }
+        sleepUntil(due);
+        showFrame(&player, queue.slots[slot]);
+        if (stats) {
+            double latency = getStageTime().wall - arrival;
+            stats->frames++;
+            stats->latency += latency;
+            if (latency > stats->max_latency)
+                stats->max_latency = latency;
+        }
+        next_show = due + min_gap;
+        due += period;
+    }
+
+    pthread_join(reader, NULL);
+    freeFramePlayer(&player);
+    if (stats)
+        stats->dropped = dropped;
+
+    pthread_cond_destroy(&queue.cond);
+    pthread_mutex_destroy(&queue.lock);
+    for (int i = 0; i < 3; i++) {
+        free(queue.slots[i]);
+    }
+    return queue.done < 0 ? -1 : 0;
+}
@@ -0,0 +1,65 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "output.h"
+#include "render.h"
+#include "stats.h"
+
+// Bytes of Y4M header lines read at a time
+#define STREAM_BUF_SIZE 4096
+
+typedef enum StreamFormat {
+    // Frames of width x height RGBA pixels back to back
+    STREAM_RGBA,
+    // YUV4MPEG2, with the size and frame rate in its header
+    STREAM_Y4M,
+} StreamFormat;
+
+typedef struct Stream {
+    int fd;
+    StreamFormat format;
+    int width;
+    int height;
+    // Frame rate from the header, 0 if unknown
+    int fps_num;
+    int fps_den;
+
+    // Y4M planes
+    int chroma_w;
+    int chroma_h;
+    int full_range;
+    uint8_t* planes;
+    size_t plane_size;
+    // Read ahead of the lines, the frame data after them is taken from here
+    // first
+    char buf[STREAM_BUF_SIZE];
+    size_t buf_pos;
+    size_t buf_len;
+} Stream;
+
+// Parse the format, "rgba:WIDTHxHEIGHT" or "y4m". Return -1 if invalid.
+int parseStreamFormat(const char* s, StreamFormat* format, int* width,
+                      int* height);
+
+// Read the header of a Y4M stream, width and height are only used for raw
+// RGBA. Return -1 with a message on stderr if the stream is not supported.
+int openStream(Stream* stream, int fd, StreamFormat format, int width,
+               int height);
+void closeStream(Stream* stream);
+
+// Read the next frame as width x height RGBA pixels. Return 1 at the end of
+// the stream, -1 with a message on stderr on errors.
+int readStreamFrame(Stream* stream, uint32_t* frame);
+
+// Show the frames at the frame rate of the stream, or fps if it has none, and
+// at most fps frames per second if it is set. Frames are dropped when showing
+// them falls behind, a stream that comes faster is read only as fast as it is
+// shown. The size is as for initFramePlayer. Return -1 if reading the stream
+// failed.
+int playStream(OutBuf* out, Stream* stream, double fps, int resize_w,
+                int resize_h, const RenderOptions* opts, Stats* stats);
+
+#endif